@@ -0,0 +1,82 @@
+#include "pch.h"
+
+#include "Admission.h"
+
+MLOG_DECLARE_LOGGER(fcgi_admission);
+
+namespace fcgi {
+
+Admission::Admission(const AdmissionLimits & limits)
+    : limits_(limits), admitted_(0), shedInFlight_(0), shedQueued_(0), shedDelay_(0),
+      inFlight_(0)
+{
+}
+
+bool Admission::admit(nexus::Microseconds now)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // age of the oldest waiting request grows even when stalled handlers start nothing
+    if(limits_.maxQueueDelay && !queued_.empty() && now - queued_.front() > limits_.maxQueueDelay)
+    {
+        ++shedDelay_;
+        return false;
+    }
+
+    if(++inFlight_ > limits_.maxInFlight && limits_.maxInFlight)
+    {
+        --inFlight_;
+        ++shedInFlight_;
+        return false;
+    }
+
+    if(queued_.size() >= limits_.maxQueued && limits_.maxQueued)
+    {
+        --inFlight_;
+        ++shedQueued_;
+        return false;
+    }
+
+    queued_.push_back(now);
+    ++admitted_;
+    return true;
+}
+
+void Admission::started(nexus::Microseconds queuedAt)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // several io threads could start requests slightly out of order
+    std::deque<nexus::Microseconds>::iterator i = std::find(queued_.begin(), queued_.end(), queuedAt);
+    if(i != queued_.end())
+        queued_.erase(i);
+}
+
+void Admission::finished()
+{
+    --inFlight_;
+}
+
+AdmissionSnapshot Admission::snapshot() const
+{
+    AdmissionSnapshot result;
+    result.admitted = admitted_;
+    result.shedInFlight = shedInFlight_;
+    result.shedQueued = shedQueued_;
+    result.shedDelay = shedDelay_;
+    result.inFlight = inFlight_;
+    boost::mutex::scoped_lock lock(mutex_);
+    result.queued = queued_.size();
+    result.queueDelay = queued_.empty() ? 0 : static_cast<size_t>(std::max<nexus::Microseconds>(nexus::Clock::microseconds() - queued_.front(), 0));
+    return result;
+}
+
+std::ostream & operator<<(std::ostream & out, const AdmissionSnapshot & snapshot)
+{
+    return out << "admitted: " << snapshot.admitted << ", shed in flight: " << snapshot.shedInFlight
+               << ", shed queued: " << snapshot.shedQueued << ", shed delay: " << snapshot.shedDelay
+               << ", in flight: " << snapshot.inFlight << ", queued: " << snapshot.queued
+               << ", queue delay: " << snapshot.queueDelay << "us";
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Defines.h"
+
+namespace fcgi {
+
+// Zero means unlimited.
+struct AdmissionLimits {
+    size_t maxInFlight; // admitted requests that were not answered yet
+    size_t maxQueued; // requests posted to io_service but not started by handler
+    nexus::Microseconds maxQueueDelay; // age of the oldest request that is queued but not started
+    bool serviceUnavailable; // shed with 503 response instead of FCGI_OVERLOADED
+
+    AdmissionLimits()
+        : maxInFlight(0), maxQueued(0), maxQueueDelay(0), serviceUnavailable(false) {}
+
+    bool any() const { return maxInFlight || maxQueued || maxQueueDelay; }
+};
+
+struct AdmissionSnapshot {
+    size_t admitted;
+    size_t shedInFlight;
+    size_t shedQueued;
+    size_t shedDelay;
+    size_t inFlight;
+    size_t queued;
+    size_t queueDelay; // age of the oldest queued request
+
+    AdmissionSnapshot()
+        : admitted(0), shedInFlight(0), shedQueued(0), shedDelay(0), inFlight(0), queued(0), queueDelay(0) {}
+};
+
+std::ostream & operator<<(std::ostream & out, const AdmissionSnapshot & snapshot);
+
+// Shared by connections of server, decides whether completed request is posted to handler or shed.
+class Admission : public mstd::reference_counter<Admission> {
+public:
+    explicit Admission(const AdmissionLimits & limits);
+
+    const AdmissionLimits & limits() const { return limits_; }
+
+    // Returns false when request should be shed, otherwise started(now) and finished() should follow.
+    // now is Clock::microseconds().
+    bool admit(nexus::Microseconds now);
+
+    // Handler is about to start, queuedAt is value passed to admit.
+    void started(nexus::Microseconds queuedAt);
+
+    // Request was answered.
+    void finished();
+
+    AdmissionSnapshot snapshot() const;
+private:
+    AdmissionLimits limits_;
+    mstd::atomic<size_t> admitted_;
+    mstd::atomic<size_t> shedInFlight_;
+    mstd::atomic<size_t> shedQueued_;
+    mstd::atomic<size_t> shedDelay_;
+    mstd::atomic<size_t> inFlight_;
+
+    mutable boost::mutex mutex_;
+    std::deque<nexus::Microseconds> queued_; // admit times of requests that did not start, mostly in order
+};
+
+typedef boost::intrusive_ptr<Admission> AdmissionPtr;
+
+}
@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "Server.h"
+#include "Trace.h"
 
 #include "App.h"
 
@@ -38,6 +39,8 @@ void consoleLoop()
             continue;
         else if(line == "stop")
             break;
+        else if(line == "trace")
+            Tracer::instance().status(std::cout);
         else if(boost::starts_with(line, "log "))
         {
             try {
@@ -70,6 +73,23 @@ public:
 
         std::cout << name << " started" << std::endl;
 
+        const char * topology = getenv((boost::to_upper_copy(name) + "_TOPOLOGY").c_str());
+        if(topology)
+            topology_ = nexus::parseTopology(topology);
+
+        // Value is slow request threshold in microseconds, 0 traces without slow log.
+        const char * trace = getenv((boost::to_upper_copy(name) + "_TRACE").c_str());
+        if(trace)
+        {
+            char * end;
+            errno = 0;
+            unsigned long slowThreshold = strtoul(trace, &end, 10);
+            if(end == trace || *end || errno)
+                MLOG_MESSAGE(Error, "invalid trace threshold: " << trace);
+            else
+                Tracer::instance().enable(slowThreshold);
+        }
+
         iotp_ = boost::in_place();
 
         if(argc > 1)
@@ -83,15 +103,24 @@ public:
 #endif
     }
 
-    void run(unsigned short port, const boost::function<void()> & starter, const RequestHandler & handler)
+    void run(unsigned short port, const std::string & path, const boost::function<void()> & starter, const RequestHandler & handler)
     {
         MLOG_MESSAGE(Debug, "run()");
 
         Server server(iotp_->ioService(), handler);
 
         starter();
-        server.start(port);
-        iotp_->start(12);
+        if(!path.empty())
+        {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+            server.start(path);
+#else
+            MLOG_MESSAGE(Error, "local sockets are not supported, path: " << path);
+            throw std::runtime_error("local sockets are not supported: " + path);
+#endif
+        } else
+            server.start(port);
+        iotp_->start(topology_);
 
         consoleLoop();
 
@@ -121,6 +150,7 @@ public:
     }
 private:
     boost::filesystem::path pid_;
+    nexus::ThreadTopology topology_;
     boost::optional<nexus::IoThreadPool> iotp_;
     std::string dbopts_;
 };
@@ -136,7 +166,12 @@ AppContext::~AppContext()
 
 void AppContext::run(unsigned short port, const boost::function<void()> & starter, const RequestHandler & handler)
 {
-    impl_->run(port, starter, handler);
+    impl_->run(port, std::string(), starter, handler);
+}
+
+void AppContext::run(const std::string & path, const boost::function<void()> & starter, const RequestHandler & handler)
+{
+    impl_->run(0, path, starter, handler);
 }
 
 boost::asio::io_service & AppContext::ioService()
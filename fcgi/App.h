@@ -10,6 +10,8 @@ public:
     ~AppContext();
 
     void run(unsigned short port, const boost::function<void()> & starter, const RequestHandler & handler);
+    // Listens on unix domain socket at path instead of tcp port, throws where local sockets are not supported.
+    void run(const std::string & path, const boost::function<void()> & starter, const RequestHandler & handler);
     boost::asio::io_service & ioService();
     const std::string & dbopts();
 private:
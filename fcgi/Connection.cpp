@@ -1,6 +1,9 @@
 #include "pch.h"
 
 #include "Connection.h"
+#include "Parser.h"
+#include "Response.h"
+#include "Trace.h"
 
 MLOG_DECLARE_LOGGER(fcgi_conn);
 
@@ -8,15 +11,6 @@ namespace fcgi {
 
 #pragma pack(push)
 #pragma pack(1)
-struct FCGIRecord {
-    uint8_t version;
-    uint8_t type;
-    RequestId requestId;
-    uint16_t contentLength;
-    uint8_t paddingLength;
-    uint8_t reserved;
-};
-
 struct FCGIBeginRequestBody {
     uint16_t role;
     uint8_t flags;
@@ -34,6 +28,13 @@ namespace {
 
 const size_t bufferSize = 0x10000;
 
+// Params are indexed in read chunk only when they take at least this share of it, otherwise
+// request would hold whole chunk and parser would allocate new one on next compact.
+const size_t inPlaceShare = 4;
+
+// Reading is paused while stream handlers lag behind by more than this, and resumed at half of it.
+const size_t maxUnconsumed = 0x100000;
+
 const uint8_t FCGI_BEGIN_REQUEST = 1;
 const uint8_t FCGI_ABORT_REQUEST = 2;
 const uint8_t FCGI_END_REQUEST = 3;
@@ -58,92 +59,281 @@ const uint8_t FCGI_UNKNOWN_ROLE     = 3;
 
 const uint8_t FCGI_KEEP_CONN = 1;
 
-size_t readLen(nexus::PacketReader & reader)
+// Limits reported in FCGI_GET_VALUES_RESULT, requests are counted per connection from begin till answer,
+// connections are not limited by server, so it is only a hint for web server.
+const size_t maxRequests = 0x40;
+const size_t maxConnections = 0x400;
+
+// Largest 8 byte aligned content that fits 16 bit contentLength, so full records need no padding.
+const size_t maxContentLength = 0xfff8;
+
+const char zeroes[8] = { 0 };
+
+size_t lenSize(size_t len)
 {
-    size_t len = reader.read<uint8_t>();
-    if(len & 0x80)
-    {
-        reader.revert(1);
-        len = mstd::ntoh(reader.read<uint32_t>()) & 0x7fffffff;
+    return len < 0x80 ? 1 : 4;
+}
+
+char * writeLen(char * out, size_t len)
+{
+    if(len < 0x80)
+        *out++ = static_cast<char>(len);
+    else {
+        uint32_t value = mstd::hton<uint32_t>(static_cast<uint32_t>(len) | 0x80000000);
+        memcpy(out, &value, sizeof(value));
+        out += sizeof(value);
     }
-    return len;
+    return out;
 }
 
+size_t paddingLen(size_t len)
+{
+    return (len + 7) / 8 * 8 - len;
 }
 
-Connection::Connection(const nexus::isocket & socket, const RequestHandler & requestHandler)
-    : socket_(socket), requestHandler_(requestHandler), pos_(0)
+char * writeRecord(char * out, uint8_t type, RequestId id, size_t len, size_t padding)
+{
+    FCGIRecord * rec = mstd::pointer_cast<FCGIRecord*>(out);
+    rec->version = 1;
+    rec->type = type;
+    rec->requestId = mstd::hton(id);
+    rec->contentLength = mstd::hton<uint16_t>(len);
+    rec->paddingLength = padding;
+    rec->reserved = 0;
+    return out + sizeof(*rec);
+}
+
+class CompareState {
+public:
+    template<class State>
+    bool operator()(const State & state, RequestId id) const
+    {
+        return state.id < id;
+    }
+};
+
+class CompareTraced {
+public:
+    bool operator()(const RequestPtr & request, RequestId id) const
+    {
+        return request->id < id;
+    }
+};
+
+}
+
+Connection::Connection(const RequestHandler & requestHandler, const StreamHandlerFactory & streamHandlerFactory,
+                       const AdmissionPtr & admission)
+    : requestHandler_(requestHandler), streamHandlerFactory_(streamHandlerFactory),
+      admission_(admission), parser_(new Parser), trace_(Tracer::instance().enabled()), readTime_(0),
+      unconsumed_(0), readPaused_(false)
 {
 }
 
 Connection::~Connection()
 {
     MLOG_MESSAGE(Debug, "~Connection()");
+
+    for(size_t i = 0; i != admitted_.size(); ++i)
+        admission_->finished();
 }
 
-void Connection::send(const char * begin, const char * end)
+void Connection::send(RequestId id, const char * begin, const char * end)
 {
-    MLOG_MESSAGE(Debug, "send(" << requestId_ << ", " << mlog::dump(begin, end) << ")");
+    MLOG_MESSAGE(Debug, "send(" << id << ", " << mlog::dump(begin, end) << ")");
 
-    const char * prefix = "Content-Type: text/plain\r\n\r\n";
-    size_t prefixLen = strlen(prefix);
-    size_t len = end - begin + prefixLen;
-    size_t alen = (len + 7) / 8 * 8;
-    RequestId reqId = mstd::hton(requestId_);
+    Response response(this, id);
+    response.write(begin, end);
+    response.finish();
+}
 
-    output_.resize(0x1000); //sizeof(FCGIRecord) + ahlen + sizeof(FCGIRecord) + alen + sizeof(FCGIRecord) + sizeof(FCGIRecord) + sizeof(FCGIEndRequestBody));
+ResponsePtr Connection::response(const Request & request)
+{
+    return ResponsePtr(new Response(this, request.id));
+}
 
-    char * out = &output_[0];
+void Connection::capture(RequestId id, const CaptureHandler & handler)
+{
+    Capture capture;
+    capture.id = id;
+    capture.handler = handler;
 
-    FCGIRecord * rec = mstd::pointer_cast<FCGIRecord*>(out);
-    rec->version = 1;
-    rec->type = FCGI_STDOUT;
-    rec->requestId = reqId;
-    rec->contentLength = mstd::hton<uint16_t>(len);
-    rec->paddingLength = alen - len;
-    rec->reserved = 0;
-    out += sizeof(*rec);
-    memcpy(out, prefix, prefixLen);
-    out += prefixLen;
-    memcpy(out, begin, end - begin);
-    out += alen - prefixLen;
+    boost::mutex::scoped_lock lock(mutex_);
+    captures_.push_back(capture);
+}
 
-    rec = mstd::pointer_cast<FCGIRecord*>(out);
-    rec->version = 1;
-    rec->type = FCGI_STDOUT;
-    rec->requestId = reqId;
-    rec->contentLength = mstd::hton<uint16_t>(0);
-    rec->paddingLength = 0;
-    rec->reserved = 0;
-    out += sizeof(*rec);
+void Connection::output(RequestId id, const Chunks & chunks, bool last, uint32_t appStatus)
+{
+    CaptureHandler captureHandler;
+    Chunks captured;
+    RequestPtr traced;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if(last)
+        {
+            std::vector<RequestId>::iterator i = std::find(posted_.begin(), posted_.end(), id);
+            if(i != posted_.end())
+                posted_.erase(i);
+        }
+        if(last && trace_)
+        {
+            std::vector<RequestPtr>::iterator i = std::lower_bound(traced_.begin(), traced_.end(), id, CompareTraced());
+            if(i != traced_.end() && (*i)->id == id)
+            {
+                traced.swap(*i);
+                traced_.erase(i);
+            }
+        }
+        if(last && admission_)
+        {
+            std::vector<RequestId>::iterator i = std::find(admitted_.begin(), admitted_.end(), id);
+            if(i != admitted_.end())
+            {
+                admitted_.erase(i);
+                admission_->finished();
+            }
+        }
+        for(Captures::iterator i = captures_.begin(), end = captures_.end(); i != end; ++i)
+            if(i->id == id)
+            {
+                i->chunks.insert(i->chunks.end(), chunks.begin(), chunks.end());
+                if(last)
+                {
+                    captureHandler.swap(i->handler);
+                    captured.swap(i->chunks);
+                    captures_.erase(i);
+                }
+                break;
+            }
+    }
 
-    rec = mstd::pointer_cast<FCGIRecord*>(out);
-    rec->version = 1;
-    rec->type = FCGI_END_REQUEST;
-    rec->requestId = reqId;
-    rec->contentLength = mstd::hton<uint16_t>(sizeof(FCGIEndRequestBody));
-    rec->paddingLength = 0;
-    rec->reserved = 0;
-    out += sizeof(*rec);
+    size_t records = 0;
+    for(Chunks::const_iterator i = chunks.begin(), end = chunks.end(); i != end; ++i)
+        records += (i->size() + maxContentLength - 1) / maxContentLength;
+
+    MLOG_MESSAGE(Debug, "output(" << id << ", chunks: " << chunks.size() << ", records: " << records << ", last: " << last << ")");
+
+    size_t headersLen = records * sizeof(FCGIRecord);
+    if(last)
+        headersLen += sizeof(FCGIRecord) + sizeof(FCGIRecord) + sizeof(FCGIEndRequestBody);
+
+    Frame frame;
+    frame.buffers.reserve(chunks.size() + 1);
+    frame.buffers.push_back(nexus::Buffer(headersLen));
+    frame.buffers.insert(frame.buffers.end(), chunks.begin(), chunks.end());
+    frame.sequence.reserve(records * 3 + 1);
+
+    char * out = frame.buffers.front().data();
+    for(Chunks::const_iterator i = chunks.begin(), end = chunks.end(); i != end; ++i)
+    {
+        const char * data = i->data();
+        size_t left = i->size();
+        while(left)
+        {
+            size_t len = std::min(left, maxContentLength);
+            size_t padding = paddingLen(len);
+            frame.sequence.push_back(boost::asio::buffer(out, sizeof(FCGIRecord)));
+            out = writeRecord(out, FCGI_STDOUT, id, len, padding);
+            frame.sequence.push_back(boost::asio::buffer(data, len));
+            if(padding)
+                frame.sequence.push_back(boost::asio::buffer(zeroes, padding));
+            data += len;
+            left -= len;
+        }
+    }
+
+    if(last)
+    {
+        char * start = out;
+        out = writeRecord(out, FCGI_STDOUT, id, 0, 0);
+        out = writeRecord(out, FCGI_END_REQUEST, id, sizeof(FCGIEndRequestBody), 0);
+        FCGIEndRequestBody * body = mstd::pointer_cast<FCGIEndRequestBody*>(out);
+        body->appStatus = mstd::hton<uint32_t>(appStatus);
+        body->protocolStatus = FCGI_REQUEST_COMPLETE;
+        memset(body->reserved, 0, sizeof(body->reserved));
+        out += sizeof(*body);
+        frame.sequence.push_back(boost::asio::buffer(start, out - start));
+        frame.traced.swap(traced);
+    }
+
+    write(frame);
+
+    if(captureHandler)
+        captureHandler(captured, appStatus);
+}
+
+size_t Connection::posted()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return posted_.size();
+}
+
+void Connection::handleRequest(const RequestPtr & request, nexus::Microseconds queuedAt)
+{
+    if(admission_)
+        admission_->started(queuedAt);
+    if(trace_)
+    {
+        request->trace.started = nexus::Clock::microseconds();
+        requestHandler_(request, ptr());
+        request->trace.finished = nexus::Clock::microseconds();
+        Tracer::instance().release(*request);
+    } else
+        requestHandler_(request, ptr());
+}
+
+void Connection::shed(RequestId id)
+{
+    MLOG_MESSAGE(Debug, "shed(" << id << ")");
+
+    if(admission_->limits().serviceUnavailable)
+    {
+        Response response(this, id);
+        response.header("Status", "503 Service Unavailable");
+        response.write("Service Unavailable");
+        response.finish();
+    } else
+        endRequest(id, FCGI_OVERLOADED);
+}
+
+void Connection::endRequest(RequestId id, uint8_t protocolStatus)
+{
+    MLOG_MESSAGE(Debug, "endRequest(" << id << ", " << static_cast<int>(protocolStatus) << ")");
+
+    nexus::Buffer output(sizeof(FCGIRecord) + sizeof(FCGIEndRequestBody));
+    char * out = writeRecord(output.data(), FCGI_END_REQUEST, id, sizeof(FCGIEndRequestBody), 0);
     FCGIEndRequestBody * body = mstd::pointer_cast<FCGIEndRequestBody*>(out);
     body->appStatus = mstd::hton<uint32_t>(0);
-    body->protocolStatus = FCGI_REQUEST_COMPLETE;
-    out += sizeof(*body);
+    body->protocolStatus = protocolStatus;
+    memset(body->reserved, 0, sizeof(body->reserved));
 
-    output_.resize(out - &output_[0]);
-    async_write(**socket_, boost::asio::buffer(output_), bindWrite(ptr()));
+    write(output);
 }
 
-void Connection::startRead()
+void Connection::write(const nexus::Buffer & buffer)
 {
-    MLOG_MESSAGE(Debug, "startRead()");
+    Frame frame;
+    frame.buffers.push_back(buffer);
+    frame.sequence.push_back(boost::asio::buffer(buffer.data(), buffer.size()));
+    write(frame);
+}
 
-    if(buffer_.size() - pos_ < 0x10000)
-    {
-        buffer_.resize(pos_ + bufferSize);
-        buffer_.resize(buffer_.capacity());
-    }
-    (*socket_)->async_read_some(boost::asio::buffer(&buffer_[pos_], buffer_.size() - pos_), bindRead(ptr()));
+void Connection::write(Frame & frame)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    bool idle = pending_.empty();
+    pending_.push_back(Frame());
+    pending_.back().swap(frame);
+    if(idle)
+        startWrite();
+}
+
+boost::asio::mutable_buffers_1 Connection::readBuffer()
+{
+    MLOG_MESSAGE(Debug, "readBuffer()");
+
+    parser_->prepare(bufferSize);
+    return boost::asio::buffer(parser_->space(), parser_->spaceSize());
 }
 
 void Connection::handleRead(const boost::system::error_code & ec, size_t bt, const ConnectionPtr & ptr)
@@ -152,68 +342,202 @@ void Connection::handleRead(const boost::system::error_code & ec, size_t bt, con
 
     if(!ec)
     {
-        pos_ += bt;
+        if(trace_)
+            readTime_ = nexus::Clock::microseconds();
+        parser_->commit(bt);
         if(processRecords())
-            startRead();
+        {
+            if(!pauseRead())
+                startRead();
+            return;
+        }
     }
+    abortBodies();
 }
 
-bool Connection::processRecords()
+bool Connection::pauseRead()
+{
+    boost::mutex::scoped_lock lock(flowMutex_);
+    if(unconsumed_ > maxUnconsumed)
+    {
+        MLOG_MESSAGE(Debug, "pause read, unconsumed: " << unconsumed_);
+        readPaused_ = true;
+    }
+    return readPaused_;
+}
+
+void Connection::deliver(const BodyStreamPtr & body, const nexus::Buffer & chunk)
+{
+    {
+        boost::mutex::scoped_lock lock(flowMutex_);
+        unconsumed_ += chunk.size();
+    }
+    body->strand.post(boost::bind(&Connection::handleChunk, ptr(), body, chunk));
+}
+
+void Connection::handleChunk(const BodyStreamPtr & body, const nexus::Buffer & chunk)
 {
-    MLOG_MESSAGE(Debug, "processRecords()");
+    body->handler->chunk(chunk);
 
-    while(pos_ >= sizeof(FCGIRecord))
+    bool resume = false;
     {
-        FCGIRecord * rec = mstd::pointer_cast<FCGIRecord*>(&buffer_[0]);
-        size_t recordLen = sizeof(*rec) + mstd::ntoh(rec->contentLength) + rec->paddingLength;
-        if(pos_ >= recordLen)
+        boost::mutex::scoped_lock lock(flowMutex_);
+        unconsumed_ -= chunk.size();
+        if(readPaused_ && unconsumed_ <= maxUnconsumed / 2)
         {
-            if(!processRecord(*rec))
-                return false;
-            memcpy(&buffer_[0], &buffer_[0] + recordLen, pos_ - recordLen);
-            pos_ -= recordLen;
-        } else
-            MLOG_MESSAGE(Debug, "Non full record: " << recordLen);
+            readPaused_ = false;
+            resume = true;
+        }
     }
+    if(resume)
+    {
+        MLOG_MESSAGE(Debug, "resume read");
+        startRead();
+    }
+}
+
+void Connection::abortBodies()
+{
+    for(RequestStates::iterator i = states_.begin(), end = states_.end(); i != end; ++i)
+        if(i->body)
+            i->body->strand.post(boost::bind(&StreamHandler::abort, i->body->handler));
+    states_.clear();
+}
+
+bool Connection::processRecords()
+{
+    MLOG_MESSAGE(Debug, "processRecords(" << parser_->received() << ")");
+
+    Record rec;
+    while(parser_->next(rec))
+        if(!processRecord(rec))
+            return false;
+
+    for(RequestStates::iterator i = states_.begin(), end = states_.end(); i != end; ++i)
+        i->detach();
+    parser_->compact();
     return true;
 }
 
-bool Connection::processRecord(const FCGIRecord & rec)
+bool Connection::processRecord(const Record & rec)
 {
-    MLOG_MESSAGE(Debug, "processRecord(type: " << static_cast<int>(rec.type) << ", len: " << mstd::ntoh(rec.contentLength) << 
-                        ", request: " << mstd::ntoh(rec.requestId) << ", padding: " << rec.paddingLength << ")");
+    RequestId id = rec.id;
+    size_t len = rec.length;
+
+    MLOG_MESSAGE(Debug, "processRecord(type: " << static_cast<int>(rec.type) << ", len: " << len << ", request: " << id << ")");
 
-    char * begin = &buffer_[0] + sizeof(rec);
+    const char * begin = rec.content;
     switch(rec.type) {
+    case FCGI_GET_VALUES:
+        processValues(begin, len);
+        break;
     case FCGI_BEGIN_REQUEST:
         {
-            FCGIBeginRequestBody * body = mstd::pointer_cast<FCGIBeginRequestBody*>(begin);
-            keepAlive_ = (body->flags & FCGI_KEEP_CONN) != 0;
-            stream_.clear();
+            const FCGIBeginRequestBody * body = mstd::pointer_cast<const FCGIBeginRequestBody*>(begin);
+            size_t requests = states_.size() + posted();
+            if(!findState(id) && requests >= maxRequests)
+            {
+                MLOG_MESSAGE(Warning, "Too many requests: " << requests << ", rejected: " << id);
+                endRequest(id, FCGI_OVERLOADED);
+                break;
+            }
+            RequestState & state = beginState(id);
+            state.keepAlive = (body->flags & FCGI_KEEP_CONN) != 0;
+            state.request = new Request;
+            state.request->id = id;
+            state.request->trace.received = readTime_;
+        }
+        break;
+    case FCGI_ABORT_REQUEST:
+        if(RequestState * state = findState(id))
+        {
+            if(state->body)
+                state->body->strand.post(boost::bind(&StreamHandler::abort, state->body->handler));
+            eraseState(id);
+            endRequest(id, FCGI_REQUEST_COMPLETE);
         }
         break;
     case FCGI_PARAMS:
         {
-            if(rec.contentLength)
-                stream_.insert(stream_.end(), begin, begin + mstd::ntoh(rec.contentLength));
+            RequestState * state = findState(id);
+            if(!state)
+                MLOG_MESSAGE(Warning, "Params for unknown request: " << id);
+            else if(len)
+                state->append(begin, len);
             else {
-                processParams();
-                stream_.clear();
+                MLOG_MESSAGE(Debug, "params(" << mlog::dump(state->data(), state->data() + state->size()) << ")");
+                if(state->slice && state->sliceLen * inPlaceShare >= parser_->chunk().size())
+                    state->request->parseParams(parser_->chunk(), state->slice, state->sliceLen);
+                else {
+                    state->detach();
+                    state->request->parseParams(state->stream);
+                }
+                state->clear();
+                if(trace_)
+                    state->request->trace.params = nexus::Clock::microseconds();
+                if(streamHandlerFactory_)
+                {
+                    StreamHandlerPtr handler = streamHandlerFactory_(state->request, ptr());
+                    if(handler)
+                        state->body = new BodyStream(handler, ioService());
+                }
             }
         }
         break;
     case FCGI_STDIN:
         {
-            if(rec.contentLength)
-                stream_.insert(stream_.end(), begin, begin + mstd::ntoh(rec.contentLength));
+            RequestState * state = findState(id);
+            if(!state)
+                MLOG_MESSAGE(Warning, "Stdin for unknown request: " << id);
+            else if(state->body)
+            {
+                if(len)
+                    deliver(state->body, nexus::Buffer(begin, len));
+                else {
+                    state->body->strand.post(boost::bind(&StreamHandler::finish, state->body->handler));
+                    bool keepAlive = state->keepAlive;
+                    eraseState(id);
+                    {
+                        boost::mutex::scoped_lock lock(mutex_);
+                        posted_.push_back(id);
+                    }
+                    if(!keepAlive)
+                        return false;
+                }
+            } else if(len)
+                state->append(begin, len);
             else {
-                RequestPtr request(new Request);
-                requestId_ = mstd::ntoh(rec.requestId);
-                request->params.swap(params_);
-                request->body = stream_.empty() ? nexus::Buffer::blank() : nexus::Buffer(&stream_[0], stream_.size());
-                stream_.clear();
-                (*socket_)->io_service().post(boost::bind(requestHandler_, request, ptr()));
-                if(!keepAlive_)
+                RequestPtr request;
+                request.swap(state->request);
+                request->body = state->size() ? nexus::Buffer(state->data(), state->size()) : nexus::Buffer::blank();
+                bool keepAlive = state->keepAlive;
+                eraseState(id);
+                nexus::Microseconds now = admission_ || trace_ ? nexus::Clock::microseconds() : 0;
+                if(admission_ && !admission_->admit(now))
+                    shed(id);
+                else if(!admission_ && !trace_)
+                {
+                    {
+                        boost::mutex::scoped_lock lock(mutex_);
+                        posted_.push_back(id);
+                    }
+                    ioService().post(boost::bind(requestHandler_, request, ptr()));
+                } else {
+                    {
+                        boost::mutex::scoped_lock lock(mutex_);
+                        posted_.push_back(id);
+                        if(admission_)
+                            admitted_.push_back(id);
+                        if(trace_)
+                        {
+                            request->trace.posted = now;
+                            request->trace.pending = 2;
+                            traced_.insert(std::lower_bound(traced_.begin(), traced_.end(), id, CompareTraced()), request);
+                        }
+                    }
+                    ioService().post(boost::bind(&Connection::handleRequest, ptr(), request, now));
+                }
+                if(!keepAlive)
                     return false;
             }
         }
@@ -225,34 +549,124 @@ bool Connection::processRecord(const FCGIRecord & rec)
     return true;
 }
 
-void Connection::processParams()
+void Connection::processValues(const char * begin, size_t len)
 {
-    MLOG_MESSAGE(Debug, "processParams(" << stream_.size() << ")");
-    MLOG_MESSAGE(Debug, "processParams(" << mlog::dump(stream_) << ")");
+    Request query;
+    std::vector<char> raw(begin, begin + len);
+    query.parseParams(raw);
 
-    nexus::PacketReader reader(stream_);
-    while(reader.left())
+    char buf[0x20];
+    Params values;
+    for(Params::const_iterator i = query.params.begin(), end = query.params.end(); i != end; ++i)
     {
-        size_t nameLen = readLen(reader);
-        size_t valueLen = readLen(reader);
-        if(reader.raw() <= reader.end() && nameLen + valueLen <= reader.left())
-        {
-            std::string name(reader.raw(), reader.raw() + nameLen);
-            reader.skip(nameLen);
-            std::string value(reader.raw(), reader.raw() + valueLen);
-            reader.skip(valueLen);
-            params_.insert(Params::value_type(name, value));
-            MLOG_MESSAGE(Debug, "param: " << name << ", value: " << value);
-        } else {
-            MLOG_MESSAGE(Error, "left: " << reader.left() << ", nameLen: " << nameLen << ", valueLen: " << valueLen);
-            break;
-        }
+        if(i->first == "FCGI_MAX_REQS")
+            values[i->first] = mstd::itoa(maxRequests, buf);
+        else if(i->first == "FCGI_MAX_CONNS")
+            values[i->first] = mstd::itoa(maxConnections, buf);
+        else if(i->first == "FCGI_MPXS_CONNS")
+            values[i->first] = "1";
+    }
+
+    size_t contentLen = 0;
+    for(Params::const_iterator i = values.begin(), end = values.end(); i != end; ++i)
+        contentLen += lenSize(i->first.length()) + lenSize(i->second.length()) + i->first.length() + i->second.length();
+    size_t padding = paddingLen(contentLen);
+
+    nexus::Buffer output(sizeof(FCGIRecord) + contentLen + padding);
+    char * out = writeRecord(output.data(), FCGI_GET_VALUES_RESULT, 0, contentLen, padding);
+    for(Params::const_iterator i = values.begin(), end = values.end(); i != end; ++i)
+    {
+        out = writeLen(out, i->first.length());
+        out = writeLen(out, i->second.length());
+        memcpy(out, i->first.c_str(), i->first.length());
+        out += i->first.length();
+        memcpy(out, i->second.c_str(), i->second.length());
+        out += i->second.length();
+    }
+    memset(out, 0, padding);
+
+    write(output);
+}
+
+Connection::RequestState * Connection::findState(RequestId id)
+{
+    RequestStates::iterator i = std::lower_bound(states_.begin(), states_.end(), id, CompareState());
+    return i != states_.end() && i->id == id ? &*i : 0;
+}
+
+Connection::RequestState & Connection::beginState(RequestId id)
+{
+    RequestStates::iterator i = std::lower_bound(states_.begin(), states_.end(), id, CompareState());
+    if(i == states_.end() || i->id != id)
+    {
+        i = states_.insert(i, RequestState(id));
+    } else {
+        i->clear();
+    }
+    i->keepAlive = false;
+    return *i;
+}
+
+void Connection::RequestState::append(const char * begin, size_t len)
+{
+    if(!slice && stream.empty())
+    {
+        slice = begin;
+        sliceLen = len;
+    } else {
+        detach();
+        stream.insert(stream.end(), begin, begin + len);
+    }
+}
+
+void Connection::RequestState::detach()
+{
+    if(slice)
+    {
+        stream.assign(slice, slice + sliceLen);
+        slice = 0;
+        sliceLen = 0;
     }
 }
 
+void Connection::eraseState(RequestId id)
+{
+    RequestStates::iterator i = std::lower_bound(states_.begin(), states_.end(), id, CompareState());
+    if(i != states_.end() && i->id == id)
+        states_.erase(i);
+}
+
 void Connection::handleWrite(const boost::system::error_code & ec, size_t bytes, const ConnectionPtr & conn)
 {
-    MLOG_MESSAGE(Debug, "handleWrite(" << ec << ')');
+    MLOG_MESSAGE(Debug, "handleWrite(" << ec << ", " << bytes << ')');
+
+    RequestPtr traced;
+    std::vector<RequestPtr> dropped;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if(!ec)
+        {
+            traced.swap(pending_.front().traced);
+            pending_.pop_front();
+            if(!pending_.empty())
+                startWrite();
+        } else {
+            MLOG_MESSAGE(Notice, "handleWrite(" << ec << ", " << ec.message() << ")");
+            for(std::deque<Frame>::iterator i = pending_.begin(), end = pending_.end(); i != end; ++i)
+                if(i->traced)
+                    dropped.push_back(i->traced);
+            pending_.clear();
+        }
+    }
+
+    if(traced)
+    {
+        traced->trace.written = nexus::Clock::microseconds();
+        Tracer::instance().release(*traced);
+    }
+    // Requests of failed connection are recorded too, their write stage stays zero.
+    for(std::vector<RequestPtr>::const_iterator i = dropped.begin(), end = dropped.end(); i != end; ++i)
+        Tracer::instance().release(**i);
 }
 
 }
@@ -1,47 +1,215 @@
 #pragma once
 
-#include "Defines.h"
+#include "Admission.h"
 
 namespace fcgi {
 
-struct FCGIRecord;
+struct Record;
+class Parser;
 
+// Serves multiplexed requests, each response is tagged with id of its request.
+// Socket I/O is provided by SocketConnection.
 class Connection : public mstd::reference_counter<Connection> {
 public:
-    explicit Connection(const nexus::isocket & socket, const RequestHandler & requestHandler);
-    ~Connection();
+    virtual ~Connection();
 
-    void send(const char * begin, const char * end);
+    // Responds to request with given id, could be called from any thread.
+    // Peer multiplexes requests, so there is no implicit current request to answer.
+    void send(RequestId id, const char * begin, const char * end);
+
+    virtual void start() { startRead(); }
+    inline void send(const Request & request, const char * begin, const char * end) { send(request.id, begin, end); }
+    inline void send(const Request & request, const char * str) { send(request.id, str, str + strlen(str)); }
+
+    // Creates writer for response with custom headers or streamed body.
+    ResponsePtr response(const Request & request);
+
+    typedef std::vector<nexus::Buffer> Chunks;
+
+    // Sends chunks as STDOUT records of request with given id without copying them,
+    // last also ends stdout stream and request.
+    void output(RequestId id, const Chunks & chunks, bool last, uint32_t appStatus);
+
+    typedef boost::function<void(const Chunks & chunks, uint32_t appStatus)> CaptureHandler;
+
+    // Collects chunks sent for request with given id, handler is called once request is finished.
+    // Handler is destroyed without call if connection is destroyed before that.
+    void capture(RequestId id, const CaptureHandler & handler);
+    virtual boost::asio::io_service & ioService() = 0;
+protected:
+    explicit Connection(const RequestHandler & requestHandler, const StreamHandlerFactory & streamHandlerFactory,
+                        const AdmissionPtr & admission);
 
-    inline void start() { startRead(); }
-    inline void send(const char * str) { send(str, str + strlen(str)); }
-    inline boost::asio::io_service & ioService() { return (*socket_)->io_service(); }   
-private:
     inline ConnectionPtr ptr()
     {
         return this;
     }
 
-    void startRead();
+    virtual void startRead() = 0;
+    virtual void startWrite() = 0;
+
+    // Free space of parser buffer to read into.
+    boost::asio::mutable_buffers_1 readBuffer();
+
+    // Sequence of frame that is being written.
+    const std::vector<boost::asio::const_buffer> & writeSequence() const { return pending_.front().sequence; }
+
     void handleRead(const boost::system::error_code & ec, size_t bt, const ConnectionPtr & ptr);
-    bool processRecords();
-    bool processRecord(const FCGIRecord & rec);
-    void processParams();
     void handleWrite(const boost::system::error_code & ec, size_t bytes, const ConnectionPtr & conn);
 
-    nexus::isocket socket_;
-    RequestHandler requestHandler_;
-    std::vector<char> buffer_;
-    std::vector<char> stream_;
-    std::vector<char> output_;
-    size_t pos_;
-    Params params_;
-    RequestId requestId_;
-    bool keepAlive_;
-
     NEXUS_DECLARE_HANDLER(Read, Connection, 1, receive, true);
     NEXUS_DECLARE_HANDLER(Write, Connection, 1, send, true);
+private:
+    // Streamed body of single request, strand keeps chunks ordered.
+    struct BodyStream : public mstd::reference_counter<BodyStream> {
+        StreamHandlerPtr handler;
+        boost::asio::io_service::strand strand;
+
+        BodyStream(const StreamHandlerPtr & h, boost::asio::io_service & ioService)
+            : handler(h), strand(ioService) {}
+    };
+    typedef boost::intrusive_ptr<BodyStream> BodyStreamPtr;
+
+    // Content of current stream is kept as slice of parser buffer while it fits single record,
+    // and is copied to stream before parser buffer is compacted.
+    struct RequestState {
+        RequestId id;
+        bool keepAlive;
+        const char * slice;
+        size_t sliceLen;
+        std::vector<char> stream;
+        RequestPtr request;
+        BodyStreamPtr body;
+
+        explicit RequestState(RequestId i)
+            : id(i), keepAlive(false), slice(0), sliceLen(0) {}
+
+        const char * data() const { return slice ? slice : (stream.empty() ? 0 : &stream[0]); }
+        size_t size() const { return slice ? sliceLen : stream.size(); }
+
+        void append(const char * begin, size_t len);
+        void detach();
+
+        void clear()
+        {
+            slice = 0;
+            sliceLen = 0;
+            stream.clear();
+        }
+    };
+    typedef std::vector<RequestState> RequestStates;
+
+    struct Capture {
+        RequestId id;
+        CaptureHandler handler;
+        Chunks chunks;
+    };
+    typedef std::vector<Capture> Captures;
+
+    // Complete records that are written with single async_write.
+    struct Frame {
+        Chunks buffers;
+        std::vector<boost::asio::const_buffer> sequence;
+        RequestPtr traced; // request whose END_REQUEST is in this frame
+
+        void swap(Frame & rhs)
+        {
+            buffers.swap(rhs.buffers);
+            sequence.swap(rhs.sequence);
+            traced.swap(rhs.traced);
+        }
+    };
+
+    bool processRecords();
+    bool processRecord(const Record & rec);
+    void processValues(const char * begin, size_t len);
+
+    RequestState * findState(RequestId id);
+    RequestState & beginState(RequestId id);
+    void eraseState(RequestId id);
+
+    void deliver(const BodyStreamPtr & body, const nexus::Buffer & chunk);
+    void handleChunk(const BodyStreamPtr & body, const nexus::Buffer & chunk);
+    void abortBodies();
+    bool pauseRead();
+
+    size_t posted();
+    void handleRequest(const RequestPtr & request, nexus::Microseconds queuedAt);
+    void shed(RequestId id);
+
+    void endRequest(RequestId id, uint8_t protocolStatus);
+    void write(const nexus::Buffer & buffer);
+    void write(Frame & frame);
+
+    RequestHandler requestHandler_;
+    StreamHandlerFactory streamHandlerFactory_;
+    AdmissionPtr admission_;
+    boost::scoped_ptr<Parser> parser_;
+    RequestStates states_; // sorted by id
+
+    boost::mutex mutex_;
+    std::deque<Frame> pending_; // front frame is being written
+    std::vector<RequestId> posted_; // requests passed to handlers that were not answered yet
+    std::vector<RequestId> admitted_; // admitted requests that were not answered yet
+    Captures captures_;
+    std::vector<RequestPtr> traced_; // posted traced requests that were not answered yet, sorted by id
+
+    bool trace_;
+    nexus::Microseconds readTime_;
+
+    boost::mutex flowMutex_;
+    size_t unconsumed_; // bytes of chunks delivered to stream handlers but not handled yet
+    bool readPaused_;
 };
 
+inline void configureSocket(boost::asio::ip::tcp::socket & socket)
+{
+    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+inline void configureSocket(boost::asio::local::stream_protocol::socket &)
+{
+}
+#endif
+
+// Connection over stream socket of any protocol, i.e. tcp or unix domain.
+template<class Socket>
+class SocketConnection : public Connection {
+public:
+    SocketConnection(boost::asio::io_service & ioService, const RequestHandler & requestHandler,
+                     const StreamHandlerFactory & streamHandlerFactory = StreamHandlerFactory(),
+                     const AdmissionPtr & admission = AdmissionPtr())
+        : Connection(requestHandler, streamHandlerFactory, admission), socket_(ioService) {}
+
+    // Socket to accept into before start.
+    Socket & socket() { return socket_; }
+
+    void start()
+    {
+        configureSocket(socket_);
+        Connection::start();
+    }
+
+    boost::asio::io_service & ioService() { return socket_.io_service(); }
+private:
+    void startRead()
+    {
+        socket_.async_read_some(readBuffer(), bindRead(ptr()));
+    }
+
+    void startWrite()
+    {
+        boost::asio::async_write(socket_, writeSequence(), bindWrite(ptr()));
+    }
+
+    Socket socket_;
+};
+
+typedef SocketConnection<boost::asio::ip::tcp::socket> TcpConnection;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+typedef SocketConnection<boost::asio::local::stream_protocol::socket> LocalConnection;
+#endif
+
 
 }
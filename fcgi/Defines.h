@@ -8,18 +8,169 @@ typedef boost::unordered_map<std::string, std::string> Params;
 class Connection;
 typedef boost::intrusive_ptr<Connection> ConnectionPtr;
 
-struct Request : public mstd::reference_counter<Request> {
-    Params params;
-    nexus::Buffer body;
+// Chars owned by someone else, usually by Request.
+class StringRef {
+public:
+    StringRef()
+        : begin_(0), end_(0) {}
+
+    StringRef(const char * begin, const char * end)
+        : begin_(begin), end_(end) {}
+
+    StringRef(const char * str)
+        : begin_(str), end_(str + strlen(str)) {}
+
+    StringRef(const std::string & str)
+        : begin_(str.c_str()), end_(str.c_str() + str.length()) {}
+
+    const char * begin() const { return begin_; }
+    const char * end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
 
-    const std::string & param(const std::string & name) const
+    std::string str() const { return std::string(begin_, end_); }
+    operator std::string() const { return str(); }
+
+    int compare(const StringRef & rhs) const
     {
-        Params::const_iterator i = params.find(name);
-        return i != params.end() ? i->second : mstd::default_instance<std::string>();
+        size_t len = std::min(size(), rhs.size());
+        int result = len ? memcmp(begin_, rhs.begin_, len) : 0;
+        return result ? result : (size() < rhs.size() ? -1 : (size() > rhs.size() ? 1 : 0));
     }
+private:
+    const char * begin_;
+    const char * end_;
+};
+
+inline bool operator==(const StringRef & lhs, const StringRef & rhs) { return lhs.size() == rhs.size() && !lhs.compare(rhs); }
+inline bool operator!=(const StringRef & lhs, const StringRef & rhs) { return !(lhs == rhs); }
+inline bool operator<(const StringRef & lhs, const StringRef & rhs) { return lhs.compare(rhs) < 0; }
+
+inline std::ostream & operator<<(std::ostream & out, const StringRef & ref)
+{
+    return out.write(ref.begin(), ref.size());
+}
+
+// Clock::microseconds() when request reached each stage, filled only while Tracer is enabled.
+struct RequestTrace {
+    nexus::Microseconds received; // read that contained BEGIN_REQUEST completed
+    nexus::Microseconds params;
+    nexus::Microseconds posted;
+    nexus::Microseconds started; // handler started
+    nexus::Microseconds finished; // handler returned
+    nexus::Microseconds written; // END_REQUEST was written to socket
+    mstd::atomic<size_t> pending; // handler end and write completion that were not reported yet
+
+    RequestTrace()
+        : received(0), params(0), posted(0), started(0), finished(0), written(0), pending(0) {}
+};
+
+struct Request;
+
+// Read only view with interface of former Params member of Request, map is built on first use.
+class ParamsView {
+public:
+    typedef Params::key_type key_type;
+    typedef Params::mapped_type mapped_type;
+    typedef Params::value_type value_type;
+    typedef Params::size_type size_type;
+    typedef Params::const_iterator const_iterator;
+    typedef Params::const_iterator iterator;
+
+    const_iterator begin() const { return map().begin(); }
+    const_iterator end() const { return map().end(); }
+    const_iterator find(const std::string & name) const { return map().find(name); }
+    size_type count(const std::string & name) const { return map().count(name); }
+    size_type size() const { return map().size(); }
+    bool empty() const { return map().empty(); }
+
+    operator const Params &() const { return map(); }
+    const Params & map() const;
+private:
+    explicit ParamsView(const Request & owner)
+        : owner_(owner) {}
+
+    ParamsView(const ParamsView &);
+    void operator=(const ParamsView &);
+
+    const Request & owner_;
+
+    friend struct Request;
+};
+
+struct Request : public mstd::reference_counter<Request> {
+    RequestId id;
+    nexus::Buffer body;
+    RequestTrace trace;
+    ParamsView params; // compatibility view, use param(StringRef) on hot paths
+
+    // Does not allocate, returned value points into request owned buffer.
+    StringRef param(const StringRef & name) const;
+
+    // Compatibility accessors, params map is built on first call, empty string is returned for missing param.
+    const std::string & param(const std::string & name) const;
+    const std::string & param(const char * name) const { return param(std::string(name)); }
+
+    // Takes raw FCGI_PARAMS stream and indexes name-value pairs in place.
+    void parseParams(std::vector<char> & raw);
+
+    // Indexes FCGI_PARAMS stream that lies in chunk without copying it, chunk is held by request.
+    void parseParams(const nexus::Buffer & chunk, const char * begin, size_t len);
+
+    Request()
+        : id(0), params(*this) {}
+
+    Request(const Request & rhs);
+    Request & operator=(const Request & rhs);
+private:
+    struct Param {
+        StringRef name;
+        StringRef value;
+    };
+    typedef std::vector<Param> Index;
+
+    class CompareParam {
+    public:
+        bool operator()(const Param & lhs, const Param & rhs) const { return lhs.name < rhs.name; }
+        bool operator()(const Param & lhs, const StringRef & rhs) const { return lhs.name < rhs; }
+        bool operator()(const StringRef & lhs, const Param & rhs) const { return lhs < rhs.name; }
+    };
+
+    void index(const char * begin, size_t len);
+    void copyParams(const Request & rhs);
+    const Params & buildParams() const;
+
+    std::vector<char> arena_;
+    nexus::Buffer chunk_;
+    Index index_; // sorted by name
+    mutable boost::mutex paramsMutex_;
+    mutable boost::scoped_ptr<Params> params_;
+
+    friend class ParamsView;
 };
 typedef boost::intrusive_ptr<Request> RequestPtr;
 
+class Response;
+typedef boost::intrusive_ptr<Response> ResponsePtr;
+
 typedef boost::function<void(const RequestPtr & request, const ConnectionPtr & conn)> RequestHandler;
 
+// Receives request body as it arrives, calls for one request are serialized.
+class StreamHandler : public mstd::reference_counter<StreamHandler> {
+public:
+    virtual void chunk(const nexus::Buffer & data) = 0;
+
+    // Body is complete, response could be sent now.
+    virtual void finish() = 0;
+
+    // Request was aborted by peer or connection was closed before body was complete.
+    virtual void abort() {}
+
+    virtual ~StreamHandler() {}
+};
+typedef boost::intrusive_ptr<StreamHandler> StreamHandlerPtr;
+
+// Called on io thread when params are parsed, returns null to receive complete body through RequestHandler.
+typedef boost::function<StreamHandlerPtr(const RequestPtr & request, const ConnectionPtr & conn)> StreamHandlerFactory;
+
 }
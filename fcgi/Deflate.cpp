@@ -0,0 +1,198 @@
+#include "pch.h"
+
+#include "Deflate.h"
+
+MLOG_DECLARE_LOGGER(fcgi_deflate);
+
+namespace fcgi {
+
+namespace {
+
+const int compressionLevel = 6;
+const int windowBits = 15;
+const int gzipWindowBits = windowBits + 16;
+const int memLevel = 8;
+const size_t outputSize = 0x4000;
+
+StringRef trim(const char * begin, const char * end)
+{
+    while(begin != end && (*begin == ' ' || *begin == '\t'))
+        ++begin;
+    while(begin != end && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+    return StringRef(begin, end);
+}
+
+bool iequals(const StringRef & lhs, const char * rhs)
+{
+    size_t len = strlen(rhs);
+    return lhs.size() == len && boost::iequals(boost::make_iterator_range(lhs.begin(), lhs.end()), rhs);
+}
+
+// Only "q=0", "q=0.0" and so on refuse coding.
+bool refused(const char * begin, const char * end)
+{
+    for(const char * p = begin; p != end; )
+    {
+        const char * next = std::find(p, end, ';');
+        StringRef param = trim(p, next);
+        if(param.size() >= 2 && (*param.begin() == 'q' || *param.begin() == 'Q') && param.begin()[1] == '=')
+        {
+            for(const char * q = param.begin() + 2; q != param.end(); ++q)
+                if(*q != '0' && *q != '.')
+                    return false;
+            return true;
+        }
+        p = next == end ? end : next + 1;
+    }
+    return false;
+}
+
+class DeflaterCache {
+public:
+    DeflaterCache()
+    {
+        free_.assign(0);
+    }
+
+    ~DeflaterCache()
+    {
+        for(size_t i = 0; i != free_.size(); ++i)
+            delete free_[i];
+    }
+
+    Deflater *& slot(Encoding encoding)
+    {
+        return free_[encoding];
+    }
+private:
+    boost::array<Deflater*, encCount> free_;
+};
+
+}
+
+Encoding negotiateEncoding(StringRef acceptEncoding)
+{
+    bool gzip = false, deflate = false;
+    for(const char * p = acceptEncoding.begin(), * end = acceptEncoding.end(); p != end; )
+    {
+        const char * next = std::find(p, end, ',');
+        const char * params = std::find(p, next, ';');
+        StringRef coding = trim(p, params);
+        if(!refused(params, next))
+        {
+            if(iequals(coding, "gzip") || iequals(coding, "x-gzip") || iequals(coding, "*"))
+                gzip = true;
+            else if(iequals(coding, "deflate"))
+                deflate = true;
+        }
+        p = next == end ? end : next + 1;
+    }
+    return gzip ? encGzip : (deflate ? encDeflate : encIdentity);
+}
+
+const char * encodingName(Encoding encoding)
+{
+    switch(encoding) {
+    case encGzip:
+        return "gzip";
+    case encDeflate:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+struct Deflater::Impl {
+    Encoding encoding;
+    z_stream stream;
+    nexus::Buffer output;
+    size_t used;
+
+    explicit Impl(Encoding e)
+        : encoding(e), used(0)
+    {
+        memset(&stream, 0, sizeof(stream));
+        if(deflateInit2(&stream, compressionLevel, Z_DEFLATED, encoding == encGzip ? gzipWindowBits : windowBits,
+                        memLevel, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::bad_alloc();
+    }
+
+    ~Impl()
+    {
+        deflateEnd(&stream);
+    }
+
+    void emit(std::vector<nexus::Buffer> & out)
+    {
+        output.resize(used);
+        out.push_back(output);
+        output = nexus::Buffer();
+        used = 0;
+    }
+};
+
+Deflater::Deflater(Encoding encoding)
+    : impl_(new Impl(encoding))
+{
+}
+
+Deflater::~Deflater()
+{
+}
+
+Deflater * Deflater::acquire(Encoding encoding)
+{
+    Deflater *& slot = mstd::tss<DeflaterCache>().slot(encoding);
+    Deflater * result = slot;
+    slot = 0;
+    return result ? result : new Deflater(encoding);
+}
+
+void Deflater::release(Deflater * deflater)
+{
+    deflateReset(&deflater->impl_->stream);
+    deflater->impl_->output = nexus::Buffer();
+    deflater->impl_->used = 0;
+
+    Deflater *& slot = mstd::tss<DeflaterCache>().slot(deflater->impl_->encoding);
+    if(!slot)
+        slot = deflater;
+    else
+        delete deflater;
+}
+
+void Deflater::compress(const char * data, size_t len, bool finish, std::vector<nexus::Buffer> & out)
+{
+    Impl & impl = *impl_;
+    z_stream & stream = impl.stream;
+    stream.next_in = mstd::pointer_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(len);
+    int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+    for(;;)
+    {
+        if(!impl.output)
+            impl.output = nexus::Buffer(outputSize);
+        stream.next_out = mstd::pointer_cast<Bytef*>(impl.output.data() + impl.used);
+        stream.avail_out = static_cast<uInt>(outputSize - impl.used);
+        int result = deflate(&stream, flush);
+        impl.used = outputSize - stream.avail_out;
+        if(result == Z_STREAM_ERROR)
+        {
+            MLOG_MESSAGE(Error, "deflate failed: " << result);
+            return;
+        }
+        if(result == Z_STREAM_END)
+        {
+            if(impl.used)
+                impl.emit(out);
+            return;
+        }
+        if(!stream.avail_out)
+            impl.emit(out);
+        else if(!finish && !stream.avail_in)
+            return;
+    }
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Defines.h"
+
+namespace fcgi {
+
+enum Encoding {
+    encIdentity,
+    encGzip,
+    encDeflate,
+    encCount,
+};
+
+// Picks encoding accepted by Accept-Encoding value, gzip is preferred, codings with q=0 are refused.
+Encoding negotiateEncoding(StringRef acceptEncoding);
+const char * encodingName(Encoding encoding);
+
+// Compression stream of single response, zlib state is reset instead of reallocated,
+// released deflaters are cached by thread that released them.
+class Deflater : public boost::noncopyable {
+public:
+    static Deflater * acquire(Encoding encoding);
+    static void release(Deflater * deflater);
+
+    // Compresses input, full output buffers are appended to out, finish also flushes the rest and ends stream.
+    void compress(const char * data, size_t len, bool finish, std::vector<nexus::Buffer> & out);
+
+    ~Deflater();
+private:
+    explicit Deflater(Encoding encoding);
+
+    struct Impl;
+    boost::scoped_ptr<Impl> impl_;
+};
+
+}
@@ -0,0 +1,68 @@
+#include "pch.h"
+
+#include "Parser.h"
+
+MLOG_DECLARE_LOGGER(fcgi_parser);
+
+namespace fcgi {
+
+Parser::Parser()
+    : begin_(0), end_(0)
+{
+}
+
+void Parser::prepare(size_t min)
+{
+    if(spaceSize() < min)
+        reallocate(std::max(end_ - begin_ + min, chunk_ ? chunk_.size() : 0));
+}
+
+void Parser::reallocate(size_t size)
+{
+    nexus::Buffer chunk(size);
+    if(begin_ != end_)
+        memcpy(chunk.data(), chunk_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+    chunk_.swap(chunk);
+}
+
+bool Parser::next(Record & record)
+{
+    size_t left = end_ - begin_;
+    if(left < sizeof(FCGIRecord))
+        return false;
+
+    const FCGIRecord * rec = mstd::pointer_cast<const FCGIRecord*>(chunk_.data() + begin_);
+    size_t length = mstd::ntoh(rec->contentLength);
+    size_t recordLen = sizeof(*rec) + length + rec->paddingLength;
+    if(left < recordLen)
+    {
+        MLOG_MESSAGE(Debug, "Non full record: " << recordLen << ", left: " << left);
+        return false;
+    }
+
+    record.type = rec->type;
+    record.id = mstd::ntoh(rec->requestId);
+    record.content = chunk_.data() + begin_ + sizeof(*rec);
+    record.length = length;
+    begin_ += recordLen;
+    return true;
+}
+
+void Parser::compact()
+{
+    if(!begin_)
+        return;
+    if(!chunk_.unique())
+    {
+        reallocate(chunk_.size());
+        return;
+    }
+    if(begin_ != end_)
+        memmove(chunk_.data(), chunk_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+}
+
+}
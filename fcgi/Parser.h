@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Defines.h"
+
+namespace fcgi {
+
+#pragma pack(push)
+#pragma pack(1)
+struct FCGIRecord {
+    uint8_t version;
+    uint8_t type;
+    RequestId requestId;
+    uint16_t contentLength;
+    uint8_t paddingLength;
+    uint8_t reserved;
+};
+#pragma pack(pop)
+
+// Record parsed in place, content points into parser chunk and is valid until next compact().
+struct Record {
+    uint8_t type;
+    RequestId id;
+    const char * content;
+    size_t length;
+};
+
+// Cursor over received bytes, so pipelined records are not shifted one by one.
+// Unparsed tail is moved to the front at most once per read, or to a new chunk
+// when current one is still referenced, i.e. by requests that index params in place.
+class Parser {
+public:
+    Parser();
+
+    // Makes at least min bytes of free space after received data.
+    void prepare(size_t min);
+
+    char * space() { return chunk_.data() + end_; }
+    size_t spaceSize() const { return chunk_ ? chunk_.size() - end_ : 0; }
+    void commit(size_t bytes) { end_ += bytes; }
+
+    bool next(Record & record);
+    void compact();
+
+    size_t received() const { return end_ - begin_; }
+
+    // Buffer that record contents point into.
+    const nexus::Buffer & chunk() const { return chunk_; }
+private:
+    void reallocate(size_t size);
+
+    nexus::Buffer chunk_;
+    size_t begin_;
+    size_t end_;
+};
+
+}
@@ -0,0 +1,137 @@
+#include "pch.h"
+
+#include "Defines.h"
+
+MLOG_DECLARE_LOGGER(fcgi_request);
+
+namespace fcgi {
+
+namespace {
+
+size_t readLen(nexus::PacketReader & reader)
+{
+    size_t len = reader.read<uint8_t>();
+    if(len & 0x80)
+    {
+        reader.revert(1);
+        len = mstd::ntoh(reader.read<uint32_t>()) & 0x7fffffff;
+    }
+    return len;
+}
+
+}
+
+StringRef Request::param(const StringRef & name) const
+{
+    Index::const_iterator i = std::lower_bound(index_.begin(), index_.end(), name, CompareParam());
+    return i != index_.end() && i->name == name ? i->value : StringRef();
+}
+
+const std::string & Request::param(const std::string & name) const
+{
+    Params::const_iterator i = params.find(name);
+    return i != params.end() ? i->second : mstd::default_instance<std::string>();
+}
+
+const Params & ParamsView::map() const
+{
+    return owner_.buildParams();
+}
+
+Request::Request(const Request & rhs)
+    : mstd::reference_counter<Request>(), id(rhs.id), body(rhs.body), trace(rhs.trace), params(*this)
+{
+    copyParams(rhs);
+}
+
+Request & Request::operator=(const Request & rhs)
+{
+    if(this != &rhs)
+    {
+        id = rhs.id;
+        body = rhs.body;
+        trace = rhs.trace;
+        copyParams(rhs);
+    }
+    return *this;
+}
+
+// Index of chunk is valid as is, index of arena is moved to the copy of arena.
+void Request::copyParams(const Request & rhs)
+{
+    arena_ = rhs.arena_;
+    chunk_ = rhs.chunk_;
+    index_ = rhs.index_;
+    if(!arena_.empty())
+    {
+        const char * from = &rhs.arena_[0];
+        const char * to = &arena_[0];
+        for(Index::iterator i = index_.begin(), end = index_.end(); i != end; ++i)
+        {
+            i->name = StringRef(to + (i->name.begin() - from), to + (i->name.end() - from));
+            i->value = StringRef(to + (i->value.begin() - from), to + (i->value.end() - from));
+        }
+    }
+    boost::mutex::scoped_lock lock(paramsMutex_);
+    params_.reset();
+}
+
+const Params & Request::buildParams() const
+{
+    boost::mutex::scoped_lock lock(paramsMutex_);
+    if(!params_)
+    {
+        params_.reset(new Params);
+        for(Index::const_iterator i = index_.begin(), end = index_.end(); i != end; ++i)
+            params_->insert(Params::value_type(i->name.str(), i->value.str()));
+    }
+    return *params_;
+}
+
+void Request::parseParams(std::vector<char> & raw)
+{
+    arena_.swap(raw);
+    chunk_ = nexus::Buffer();
+    index(arena_.empty() ? 0 : &arena_[0], arena_.size());
+}
+
+void Request::parseParams(const nexus::Buffer & chunk, const char * begin, size_t len)
+{
+    std::vector<char>().swap(arena_);
+    chunk_ = chunk;
+    index(begin, len);
+}
+
+void Request::index(const char * begin, size_t len)
+{
+    index_.clear();
+    {
+        boost::mutex::scoped_lock lock(paramsMutex_);
+        params_.reset();
+    }
+    if(!len)
+        return;
+
+    nexus::PacketReader reader(begin, len);
+    while(reader.left())
+    {
+        size_t nameLen = readLen(reader);
+        size_t valueLen = readLen(reader);
+        if(reader.raw() <= reader.end() && nameLen + valueLen <= reader.left())
+        {
+            Param param;
+            param.name = StringRef(reader.raw(), reader.raw() + nameLen);
+            reader.skip(nameLen);
+            param.value = StringRef(reader.raw(), reader.raw() + valueLen);
+            reader.skip(valueLen);
+            MLOG_MESSAGE(Debug, "param: " << param.name << ", value: " << param.value);
+            index_.push_back(param);
+        } else {
+            MLOG_MESSAGE(Error, "left: " << reader.left() << ", nameLen: " << nameLen << ", valueLen: " << valueLen);
+            break;
+        }
+    }
+    std::stable_sort(index_.begin(), index_.end(), CompareParam());
+}
+
+}
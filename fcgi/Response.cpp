@@ -0,0 +1,146 @@
+#include "pch.h"
+
+#include "Connection.h"
+
+#include "Response.h"
+
+MLOG_DECLARE_LOGGER(fcgi_response);
+
+namespace fcgi {
+
+Response::Response(const ConnectionPtr & conn, RequestId id)
+    : conn_(conn), id_(id), headers_(headersStorage_, sizeof(headersStorage_)),
+      contentType_(false), contentEncoding_(false), started_(false), finished_(false),
+      encoding_(encIdentity), threshold_(0), heldSize_(0), deflater_(0)
+{
+}
+
+Response::~Response()
+{
+    if(!finished_)
+        finish();
+    if(deflater_)
+        Deflater::release(deflater_);
+}
+
+void Response::header(const std::string & name, const std::string & value)
+{
+    if(started_)
+    {
+        MLOG_MESSAGE(Warning, "header(" << name << ") after response started, request: " << id_);
+        return;
+    }
+
+    if(boost::iequals(name, "Content-Type"))
+        contentType_ = true;
+    else if(boost::iequals(name, "Content-Encoding"))
+    {
+        contentEncoding_ = true;
+        encoding_ = encIdentity;
+    }
+    headers_.put(name);
+    headers_.put(": ");
+    headers_.put(value);
+    headers_.put("\r\n");
+}
+
+void Response::compress(const Request & request, size_t threshold)
+{
+    if(started_ || heldSize_)
+    {
+        MLOG_MESSAGE(Warning, "compress() after response started, request: " << id_);
+        return;
+    }
+
+    header("Vary", "Accept-Encoding");
+    if(!contentEncoding_)
+        encoding_ = negotiateEncoding(request.param(StringRef("HTTP_ACCEPT_ENCODING")));
+    threshold_ = threshold;
+}
+
+void Response::write(const nexus::Buffer & body)
+{
+    flush(&body, false, 0);
+}
+
+void Response::write(const char * begin, const char * end)
+{
+    nexus::Buffer body(begin, end);
+    flush(&body, false, 0);
+}
+
+void Response::finish(uint32_t appStatus)
+{
+    flush(0, true, appStatus);
+}
+
+void Response::flush(const nexus::Buffer * body, bool last, uint32_t appStatus)
+{
+    if(finished_)
+    {
+        MLOG_MESSAGE(Warning, "flush() after response finished, request: " << id_);
+        return;
+    }
+
+    Connection::Chunks chunks;
+    if(encoding_ != encIdentity && !started_)
+    {
+        if(body && body->size())
+        {
+            held_.push_back(*body);
+            heldSize_ += body->size();
+        }
+        body = 0;
+        if(heldSize_ < threshold_)
+        {
+            if(!last)
+                return;
+            encoding_ = encIdentity;
+        } else {
+            // header() would reset encoding, so line is appended directly
+            deflater_ = Deflater::acquire(encoding_);
+            headers_.put("Content-Encoding: ");
+            headers_.put(encodingName(encoding_));
+            headers_.put("\r\n");
+        }
+
+        start(chunks);
+        for(Connection::Chunks::const_iterator i = held_.begin(), end = held_.end(); i != end; ++i)
+        {
+            if(deflater_)
+                deflater_->compress(i->data(), i->size(), false, chunks);
+            else
+                chunks.push_back(*i);
+        }
+        Connection::Chunks().swap(held_);
+    } else if(!started_)
+        start(chunks);
+
+    if(deflater_)
+    {
+        if(body && body->size())
+            deflater_->compress(body->data(), body->size(), false, chunks);
+        if(last)
+        {
+            deflater_->compress(0, 0, true, chunks);
+            Deflater::release(deflater_);
+            deflater_ = 0;
+        }
+    } else if(body && body->size())
+        chunks.push_back(*body);
+    finished_ = last;
+
+    if(!chunks.empty() || last)
+        conn_->output(id_, chunks, last, appStatus);
+}
+
+void Response::start(Connection::Chunks & chunks)
+{
+    if(!contentType_)
+        headers_.put("Content-Type: text/plain\r\n");
+    headers_.put("\r\n");
+    chunks.push_back(headers_.buffer());
+    started_ = true;
+}
+
+}
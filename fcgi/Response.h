@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Deflate.h"
+
+namespace fcgi {
+
+// Writes response of single request, headers are sent with first written chunk.
+// Body buffers are gathered into STDOUT records without copying.
+class Response : public mstd::reference_counter<Response> {
+public:
+    explicit Response(const ConnectionPtr & conn, RequestId id);
+    ~Response();
+
+    // Adds header line, should be called before first write.
+    void header(const std::string & name, const std::string & value);
+
+    // Compresses body with encoding accepted by request, should be called before first write.
+    // Body is held until it reaches threshold, shorter bodies are sent raw.
+    void compress(const Request & request, size_t threshold = 0x400);
+
+    void write(const nexus::Buffer & body);
+    void write(const char * begin, const char * end);
+    inline void write(const char * str) { write(str, str + strlen(str)); }
+    inline void write(const std::string & str) { write(str.c_str(), str.c_str() + str.length()); }
+
+    // Ends response, called by destructor if was not called explicitly.
+    void finish(uint32_t appStatus = 0);
+
+    inline bool finished() const { return finished_; }
+private:
+    void flush(const nexus::Buffer * body, bool last, uint32_t appStatus);
+    void start(std::vector<nexus::Buffer> & chunks);
+
+    ConnectionPtr conn_;
+    RequestId id_;
+    // Usual headers fit inline storage and are copied once into chunk, longer spill to pooled chunk that is sent as is.
+    char headersStorage_[0x200];
+    nexus::GrowingStackStream headers_;
+    bool contentType_;
+    bool contentEncoding_;
+    bool started_;
+    bool finished_;
+
+    Encoding encoding_;
+    size_t threshold_;
+    std::vector<nexus::Buffer> held_;
+    size_t heldSize_;
+    Deflater * deflater_;
+};
+
+}
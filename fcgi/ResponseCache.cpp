@@ -0,0 +1,302 @@
+#include "pch.h"
+
+#include "ResponseCache.h"
+
+MLOG_DECLARE_LOGGER(fcgi_cache);
+
+namespace fcgi {
+
+namespace {
+
+struct Waiter {
+    RequestPtr request;
+    ConnectionPtr conn;
+
+    Waiter(const RequestPtr & r, const ConnectionPtr & c)
+        : request(r), conn(c) {}
+};
+
+typedef std::vector<Waiter> Waiters;
+
+size_t chunksSize(const Connection::Chunks & chunks)
+{
+    size_t result = 0;
+    for(Connection::Chunks::const_iterator i = chunks.begin(), end = chunks.end(); i != end; ++i)
+        result += i->size();
+    return result;
+}
+
+// Status header of CGI response, missing one means 200, 0 if header block is not in first chunk.
+int responseStatus(const Connection::Chunks & chunks)
+{
+    if(chunks.empty())
+        return 0;
+    const char * begin = chunks.front().data();
+    const char * end = begin + chunks.front().size();
+    const char separator[] = "\r\n\r\n";
+    const char * headersEnd = std::search(begin, end, separator, separator + 4);
+    if(headersEnd == end)
+        return 0;
+    const char status[] = "Status:";
+    const size_t statusLen = sizeof(status) - 1;
+    for(const char * line = begin; line < headersEnd;)
+    {
+        const char * lineEnd = std::search(line, headersEnd, separator, separator + 2);
+        if(static_cast<size_t>(lineEnd - line) > statusLen &&
+           boost::iequals(boost::make_iterator_range(line, line + statusLen), status))
+            return atoi(std::string(line + statusLen, lineEnd).c_str());
+        line = lineEnd + 2;
+    }
+    return 200;
+}
+
+}
+
+// Held by capture of leading call, releases waiters when connection drops it unanswered.
+class ResponseCache::Leader : public mstd::reference_counter<Leader> {
+public:
+    Leader(ResponseCache & cache, const std::string & key, size_t generation, boost::asio::io_service & ioService)
+        : cache_(cache), key_(key), generation_(generation), answered_(false), timer_(ioService)
+    {
+        timer_.expires_from_now(boost::posix_time::milliseconds(cache.options_.ttl));
+        timer_.async_wait(boost::bind(&ResponseCache::expire, &cache, key, generation, _1));
+    }
+
+    ~Leader()
+    {
+        boost::system::error_code ec;
+        timer_.cancel(ec);
+        if(!answered_)
+            cache_.abandon(key_, generation_);
+    }
+
+    const std::string & key() const { return key_; }
+    size_t generation() const { return generation_; }
+
+    void answered()
+    {
+        answered_ = true;
+        boost::system::error_code ec;
+        timer_.cancel(ec);
+    }
+private:
+    ResponseCache & cache_;
+    std::string key_;
+    size_t generation_;
+    bool answered_;
+    boost::asio::deadline_timer timer_;
+};
+
+struct ResponseCache::Shard {
+    struct Entry;
+    typedef boost::unordered_map<std::string, Entry> Entries;
+    typedef std::list<Entries::value_type*> Lru;
+
+    // Pending entry waits for handler and is not in lru, expires is deadline of that call.
+    struct Entry {
+        bool pending;
+        size_t generation; // of leading call
+        nexus::Milliseconds expires;
+        Connection::Chunks chunks;
+        size_t bytes;
+        Waiters waiters;
+        Lru::iterator lru;
+
+        Entry()
+            : pending(true), generation(0), expires(0), bytes(0) {}
+    };
+
+    boost::mutex mutex;
+    Entries entries;
+    Lru lru; // most recently used first
+    size_t bytes;
+    size_t generation;
+
+    Shard()
+        : bytes(0), generation(0) {}
+
+    void unlink(Entry & entry)
+    {
+        lru.erase(entry.lru);
+        bytes -= entry.bytes;
+        entry.chunks.clear();
+        entry.bytes = 0;
+    }
+};
+
+ResponseCache::ResponseCache(const RequestHandler & handler, const CacheOptions & options)
+    : handler_(handler), options_(options), shards_(new Shard[std::max<size_t>(options.shards, 1)]),
+      hits_(0), misses_(0), coalesced_(0), evicted_(0)
+{
+    options_.shards = std::max<size_t>(options_.shards, 1);
+}
+
+ResponseCache::~ResponseCache()
+{
+}
+
+RequestHandler ResponseCache::handler()
+{
+    return boost::bind(&ResponseCache::handle, this, _1, _2);
+}
+
+std::string ResponseCache::key(const Request & request) const
+{
+    std::string result;
+    for(std::vector<std::string>::const_iterator i = options_.keyParams.begin(), end = options_.keyParams.end(); i != end; ++i)
+    {
+        StringRef value = request.param(StringRef(*i));
+        result.append(value.begin(), value.end());
+        result += '\0';
+    }
+    result += encodingName(negotiateEncoding(request.param(StringRef("HTTP_ACCEPT_ENCODING"))));
+    return result;
+}
+
+ResponseCache::Shard & ResponseCache::shard(const std::string & key)
+{
+    return shards_[boost::hash<std::string>()(key) % options_.shards];
+}
+
+void ResponseCache::handle(const RequestPtr & request, const ConnectionPtr & conn)
+{
+    std::string k = key(*request);
+    Shard & shard = this->shard(k);
+    nexus::Milliseconds now = nexus::Clock::milliseconds();
+    size_t generation;
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        Shard::Entry & entry = shard.entries[k];
+        if(entry.pending)
+        {
+            if(entry.expires > now)
+            {
+                entry.waiters.push_back(Waiter(request, conn));
+                ++coalesced_;
+                return;
+            }
+            // handler did not answer within ttl, so this request calls it again
+        } else if(entry.expires > now) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru);
+            Connection::Chunks chunks = entry.chunks;
+            lock.unlock();
+            ++hits_;
+            conn->output(request->id, chunks, true, 0);
+            return;
+        } else {
+            shard.unlink(entry);
+            entry.pending = true;
+        }
+        entry.expires = now + options_.ttl;
+        entry.generation = generation = ++shard.generation;
+    }
+    ++misses_;
+
+    conn->capture(request->id, boost::bind(&ResponseCache::store, this,
+                                           LeaderPtr(new Leader(*this, k, generation, conn->ioService())), _1, _2));
+    try {
+        handler_(request, conn);
+    } catch(...) {
+        abandon(k, generation);
+        throw;
+    }
+}
+
+void ResponseCache::store(const LeaderPtr & leader, const Connection::Chunks & chunks, uint32_t appStatus)
+{
+    leader->answered();
+    const std::string & key = leader->key();
+    int status = appStatus ? 0 : responseStatus(chunks);
+    if(status < 200 || status >= 300)
+    {
+        MLOG_MESSAGE(Debug, "response not cached, app status: " << appStatus << ", status: " << status);
+        abandon(key, leader->generation());
+        return;
+    }
+
+    Shard & shard = this->shard(key);
+    size_t bytes = chunksSize(chunks);
+    size_t limit = options_.maxBytes / options_.shards;
+    Waiters waiters;
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        Shard::Entries::iterator i = shard.entries.insert(Shard::Entries::value_type(key, Shard::Entry())).first;
+        Shard::Entry & entry = i->second;
+        waiters.swap(entry.waiters);
+        if(!entry.pending)
+            shard.unlink(entry);
+
+        if(bytes > limit)
+        {
+            MLOG_MESSAGE(Debug, "response too large to cache: " << bytes);
+            shard.entries.erase(i);
+        } else {
+            entry.pending = false;
+            entry.expires = nexus::Clock::milliseconds() + options_.ttl;
+            entry.chunks = chunks;
+            entry.bytes = bytes;
+            entry.lru = shard.lru.insert(shard.lru.begin(), &*i);
+            shard.bytes += bytes;
+
+            while(shard.bytes > limit)
+            {
+                Shard::Entries::value_type * victim = shard.lru.back();
+                shard.unlink(victim->second);
+                shard.entries.erase(shard.entries.find(victim->first));
+                ++evicted_;
+            }
+        }
+    }
+
+    for(Waiters::const_iterator i = waiters.begin(), end = waiters.end(); i != end; ++i)
+        i->conn->output(i->request->id, chunks, true, 0);
+}
+
+void ResponseCache::expire(const std::string & key, size_t generation, const boost::system::error_code & ec)
+{
+    if(!ec)
+        abandon(key, generation);
+}
+
+void ResponseCache::abandon(const std::string & key, size_t generation)
+{
+    Shard & shard = this->shard(key);
+    Waiters waiters;
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        Shard::Entries::iterator i = shard.entries.find(key);
+        if(i == shard.entries.end() || !i->second.pending || i->second.generation != generation)
+            return;
+        waiters.swap(i->second.waiters);
+        shard.entries.erase(i);
+    }
+
+    if(!waiters.empty())
+        MLOG_MESSAGE(Debug, "leading call abandoned, released waiters: " << waiters.size());
+    for(Waiters::const_iterator i = waiters.begin(), end = waiters.end(); i != end; ++i)
+        i->conn->ioService().post(boost::bind(handler_, i->request, i->conn));
+}
+
+CacheSnapshot ResponseCache::snapshot() const
+{
+    CacheSnapshot result;
+    result.hits = hits_;
+    result.misses = misses_;
+    result.coalesced = coalesced_;
+    result.evicted = evicted_;
+    result.bytes = 0;
+    for(size_t i = 0; i != options_.shards; ++i)
+    {
+        boost::mutex::scoped_lock lock(shards_[i].mutex);
+        result.bytes += shards_[i].bytes;
+    }
+    return result;
+}
+
+std::ostream & operator<<(std::ostream & out, const CacheSnapshot & snapshot)
+{
+    return out << "hits: " << snapshot.hits << ", misses: " << snapshot.misses << ", coalesced: " << snapshot.coalesced
+               << ", evicted: " << snapshot.evicted << ", bytes: " << snapshot.bytes;
+}
+
+}
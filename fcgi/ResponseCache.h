@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Connection.h"
+#include "Deflate.h"
+
+namespace fcgi {
+
+struct CacheOptions {
+    std::vector<std::string> keyParams; // params that select response, for example SCRIPT_NAME and QUERY_STRING
+    nexus::Milliseconds ttl;
+    size_t maxBytes; // bound on cached response bytes of all shards
+    size_t shards;
+
+    CacheOptions()
+        : ttl(1000), maxBytes(0x4000000), shards(0x10) {}
+};
+
+struct CacheSnapshot {
+    size_t hits;
+    size_t misses;
+    size_t coalesced;
+    size_t evicted;
+    size_t bytes;
+};
+
+std::ostream & operator<<(std::ostream & out, const CacheSnapshot & snapshot);
+
+// Sits between Connection and RequestHandler, requests with equal key params within ttl are
+// answered from cached response chunks, concurrent misses wait for single handler call.
+// Only 2xx responses with zero app status are cached, negotiated encoding is part of the key.
+// Waiters are passed to handler themselves when leading call fails, is not answered within ttl
+// or its connection is closed.
+// Chunks written by handler are shared with cache, so they should not be modified after write.
+class ResponseCache : public boost::noncopyable {
+public:
+    explicit ResponseCache(const RequestHandler & handler, const CacheOptions & options = CacheOptions());
+    ~ResponseCache();
+
+    // Handler to pass to Server, cache should outlive it.
+    RequestHandler handler();
+
+    void handle(const RequestPtr & request, const ConnectionPtr & conn);
+
+    CacheSnapshot snapshot() const;
+private:
+    struct Shard;
+    class Leader;
+    typedef boost::intrusive_ptr<Leader> LeaderPtr;
+
+    std::string key(const Request & request) const;
+    Shard & shard(const std::string & key);
+    void store(const LeaderPtr & leader, const Connection::Chunks & chunks, uint32_t appStatus);
+    void expire(const std::string & key, size_t generation, const boost::system::error_code & ec);
+    void abandon(const std::string & key, size_t generation);
+
+    RequestHandler handler_;
+    CacheOptions options_;
+    boost::scoped_array<Shard> shards_;
+    mstd::atomic<size_t> hits_;
+    mstd::atomic<size_t> misses_;
+    mstd::atomic<size_t> coalesced_;
+    mstd::atomic<size_t> evicted_;
+};
+
+}
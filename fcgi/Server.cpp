@@ -8,8 +8,13 @@ MLOG_DECLARE_LOGGER(fcgi_server);
 
 namespace fcgi {
 
-Server::Server(boost::asio::io_service & ioService, const RequestHandler & handler)
-    : acceptor_(ioService), handler_(handler) {}
+Server::Server(boost::asio::io_service & ioService, const RequestHandler & handler,
+               const StreamHandlerFactory & streamHandlerFactory, const AdmissionLimits & limits)
+    : acceptor_(ioService),
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+      localAcceptor_(ioService),
+#endif
+      handler_(handler), streamHandlerFactory_(streamHandlerFactory), admission_(limits.any() ? new Admission(limits) : 0) {}
 
 void Server::start(unsigned short port)
 {
@@ -22,27 +27,33 @@ void Server::start(unsigned short port)
 void Server::stop()
 {
     acceptor_.close();
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if(localAcceptor_.is_open())
+    {
+        localAcceptor_.close();
+        boost::system::error_code ec;
+        boost::filesystem::remove(path_, ec);
+    }
+#endif
 }
 
 void Server::startAccept()
 {
     MLOG_MESSAGE(Debug, "startAccept()");
 
-    nexus::isocket socket(new nexus::Socket(acceptor_.io_service()));
-    acceptor_.async_accept(**socket, bindAccept(socket));
+    boost::intrusive_ptr<TcpConnection> conn(new TcpConnection(acceptor_.io_service(), handler_, streamHandlerFactory_, admission_));
+    acceptor_.async_accept(conn->socket(), bindAccept(ConnectionPtr(conn)));
 }
 
-void Server::handleAccept(const boost::system::error_code & ec, const nexus::isocket & socket)
+void Server::handleAccept(const boost::system::error_code & ec, const ConnectionPtr & conn)
 {
     MLOG_MESSAGE(Info, "handleAccept(" << ec << ")");
 
     if(!ec)
     {
-        MLOG_MESSAGE(Debug, "accepted, local: " << (*socket)->local_endpoint() << ", remote: " << (*socket)->remote_endpoint());
-
-        (*socket)->set_option(boost::asio::ip::tcp::no_delay(true));
+        TcpConnection & tcp = static_cast<TcpConnection&>(*conn);
+        MLOG_MESSAGE(Debug, "accepted, local: " << tcp.socket().local_endpoint() << ", remote: " << tcp.socket().remote_endpoint());
 
-        ConnectionPtr conn = new Connection(socket, handler_);
         conn->start();
 
         startAccept();
@@ -51,4 +62,47 @@ void Server::handleAccept(const boost::system::error_code & ec, const nexus::iso
     }
 }
 
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+void Server::start(const std::string & path)
+{
+    MLOG_MESSAGE(Debug, "start(" << path << ")");
+
+    // Stale socket of previous run is replaced, any other file makes bind fail.
+    struct stat st;
+    if(!lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(path, ec);
+    }
+    boost::asio::local::stream_protocol::endpoint endpoint(path);
+    localAcceptor_.open(endpoint.protocol());
+    localAcceptor_.bind(endpoint);
+    localAcceptor_.listen();
+    path_ = path;
+    startLocalAccept();
+}
+
+void Server::startLocalAccept()
+{
+    MLOG_MESSAGE(Debug, "startLocalAccept()");
+
+    boost::intrusive_ptr<LocalConnection> conn(new LocalConnection(localAcceptor_.io_service(), handler_, streamHandlerFactory_, admission_));
+    localAcceptor_.async_accept(conn->socket(), bindLocalAccept(ConnectionPtr(conn)));
+}
+
+void Server::handleLocalAccept(const boost::system::error_code & ec, const ConnectionPtr & conn)
+{
+    MLOG_MESSAGE(Info, "handleLocalAccept(" << ec << ")");
+
+    if(!ec)
+    {
+        conn->start();
+
+        startLocalAccept();
+    } else {
+        MLOG_MESSAGE(Warning, "Accept failed: " << ec << ", message: " << ec.message());
+    }
+}
+#endif
+
 }
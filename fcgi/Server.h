@@ -1,23 +1,45 @@
 #pragma once
 
-#include "Defines.h"
+#include "Admission.h"
 
 namespace fcgi {
 
 class Server {
 public:
-    Server(boost::asio::io_service & ioService, const RequestHandler & handler);
+    // Bodies of requests accepted by streamHandlerFactory are streamed instead of passed to handler.
+    // Requests passed to handler are shed above limits, streamed requests are not.
+    Server(boost::asio::io_service & ioService, const RequestHandler & handler,
+           const StreamHandlerFactory & streamHandlerFactory = StreamHandlerFactory(),
+           const AdmissionLimits & limits = AdmissionLimits());
 
     void start(unsigned short port);
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    // Listens on unix domain socket, stale socket file at path is removed.
+    void start(const std::string & path);
+#endif
     void stop();
+
+    AdmissionSnapshot admission() const { return admission_ ? admission_->snapshot() : AdmissionSnapshot(); }
 private:
     void startAccept();
-    void handleAccept(const boost::system::error_code & ec, const nexus::isocket & socket);
+    void handleAccept(const boost::system::error_code & ec, const ConnectionPtr & conn);
 
     boost::asio::ip::tcp::acceptor acceptor_;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    void startLocalAccept();
+    void handleLocalAccept(const boost::system::error_code & ec, const ConnectionPtr & conn);
+
+    boost::asio::local::stream_protocol::acceptor localAcceptor_;
+    std::string path_;
+#endif
     RequestHandler handler_;
+    StreamHandlerFactory streamHandlerFactory_;
+    AdmissionPtr admission_;
 
     NEXUS_DECLARE_HANDLER(Accept, Server, 1, accept, true);
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    NEXUS_DECLARE_HANDLER(LocalAccept, Server, 1, accept, true);
+#endif
 };
 
 }
@@ -0,0 +1,184 @@
+#include "pch.h"
+
+#include "Trace.h"
+
+MLOG_DECLARE_LOGGER(fcgi_trace);
+
+namespace fcgi {
+
+namespace {
+
+const size_t shardsCount = 0x10;
+
+// SCRIPT_NAME is usually controlled by client, so endpoints past the limit share one entry.
+const size_t maxEndpoints = 0x400;
+const char * otherEndpoint = "<other>";
+
+const char * stageNames[tsCount] = { "parse", "queue", "handler", "write", "total" };
+
+class HashName {
+public:
+    size_t operator()(const std::string & name) const { return boost::hash_range(name.begin(), name.end()); }
+    size_t operator()(const StringRef & name) const { return boost::hash_range(name.begin(), name.end()); }
+};
+
+class EqualName {
+public:
+    bool operator()(const std::string & lhs, const std::string & rhs) const { return lhs == rhs; }
+    bool operator()(const StringRef & lhs, const std::string & rhs) const { return lhs == StringRef(rhs); }
+    bool operator()(const std::string & lhs, const StringRef & rhs) const { return StringRef(lhs) == rhs; }
+};
+
+nexus::Microseconds elapsed(nexus::Microseconds from, nexus::Microseconds to)
+{
+    return from && to > from ? to - from : 0;
+}
+
+// Upper bound of bucket that contains given fraction of samples.
+nexus::Microseconds quantile(const nexus::LatencyHistogram & histogram, size_t count, double fraction)
+{
+    size_t target = static_cast<size_t>(count * fraction);
+    size_t sum = 0;
+    for(size_t i = 0; i != histogram.size(); ++i)
+    {
+        sum += histogram[i];
+        if(sum > target)
+            return static_cast<nexus::Microseconds>(1) << i;
+    }
+    return 0;
+}
+
+typedef boost::unordered_map<std::string, TraceHistograms, HashName, EqualName> Endpoints;
+
+// Threads are spread over shards like in nexus::TrafficStats, so mutex is contended only by snapshot
+// or when there are more threads than shards.
+struct Shard {
+    boost::mutex mutex;
+    Endpoints endpoints;
+};
+
+void nullDeleter(Shard *)
+{
+}
+
+}
+
+struct Tracer::Impl {
+    boost::array<Shard, shardsCount> shards;
+    boost::thread_specific_ptr<Shard> current;
+    mstd::atomic<size_t> next;
+    mstd::atomic<size_t> endpoints; // entries in all shards, same endpoint is counted once per shard
+
+    Impl()
+        : current(&nullDeleter), next(0), endpoints(0) {}
+
+    Shard & shard()
+    {
+        Shard * result = current.get();
+        if(!result)
+        {
+            result = &shards[next++ % shardsCount];
+            current.reset(result);
+        }
+        return *result;
+    }
+};
+
+Tracer::Tracer()
+    : impl_(new Impl), enabled_(false), slowThreshold_(0)
+{
+}
+
+Tracer::~Tracer()
+{
+}
+
+void Tracer::enable(nexus::Microseconds slowThreshold)
+{
+    slowThreshold_ = slowThreshold;
+    enabled_ = true;
+}
+
+void Tracer::release(Request & request)
+{
+    if(!--request.trace.pending)
+        record(request);
+}
+
+void Tracer::record(const Request & request)
+{
+    const RequestTrace & trace = request.trace;
+    nexus::Microseconds stages[tsCount];
+    stages[tsParse] = elapsed(trace.received, trace.posted);
+    stages[tsQueue] = elapsed(trace.posted, trace.started);
+    stages[tsHandler] = elapsed(trace.started, trace.finished);
+    stages[tsWrite] = elapsed(trace.finished, trace.written);
+    stages[tsTotal] = elapsed(trace.received, std::max(trace.finished, trace.written));
+
+    StringRef name = request.param(StringRef("SCRIPT_NAME"));
+    {
+        Shard & shard = impl_->shard();
+        boost::mutex::scoped_lock lock(shard.mutex);
+        Endpoints::iterator i = shard.endpoints.find(name, HashName(), EqualName());
+        if(i == shard.endpoints.end())
+        {
+            std::string key = name.str();
+            if(impl_->endpoints++ >= maxEndpoints)
+            {
+                --impl_->endpoints;
+                key = otherEndpoint;
+                i = shard.endpoints.find(key);
+            }
+            if(i == shard.endpoints.end())
+            {
+                TraceHistograms histograms;
+                for(size_t j = 0; j != histograms.size(); ++j)
+                    histograms[j].assign(0);
+                i = shard.endpoints.insert(Endpoints::value_type(key, histograms)).first;
+            }
+        }
+        for(size_t j = 0; j != tsCount; ++j)
+            ++i->second[j][nexus::latencyBucket(stages[j])];
+    }
+
+    if(slowThreshold_ && stages[tsTotal] > slowThreshold_)
+        MLOG_MESSAGE(Warning, "slow request: " << name << ", total: " << stages[tsTotal] << "us, parse: " << stages[tsParse]
+                              << "us, queue: " << stages[tsQueue] << "us, handler: " << stages[tsHandler]
+                              << "us, write: " << stages[tsWrite] << "us, params: " << elapsed(trace.received, trace.params) << "us");
+}
+
+TraceSnapshot Tracer::snapshot()
+{
+    TraceSnapshot result;
+    for(size_t i = 0; i != shardsCount; ++i)
+    {
+        Shard & shard = impl_->shards[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        for(Endpoints::const_iterator j = shard.endpoints.begin(), end = shard.endpoints.end(); j != end; ++j)
+        {
+            std::pair<TraceSnapshot::iterator, bool> p = result.insert(*j);
+            if(!p.second)
+                for(size_t k = 0; k != tsCount; ++k)
+                    for(size_t l = 0; l != p.first->second[k].size(); ++l)
+                        p.first->second[k][l] += j->second[k][l];
+        }
+    }
+    return result;
+}
+
+void Tracer::status(std::ostream & out)
+{
+    TraceSnapshot endpoints = snapshot();
+    for(TraceSnapshot::const_iterator i = endpoints.begin(), end = endpoints.end(); i != end; ++i)
+    {
+        const nexus::LatencyHistogram & total = i->second[tsTotal];
+        size_t count = std::accumulate(total.begin(), total.end(), static_cast<size_t>(0));
+        out << (i->first.empty() ? "<none>" : i->first) << ": " << count;
+        for(size_t j = 0; j != tsCount; ++j)
+            out << ", " << stageNames[j] << " p50<" << quantile(i->second[j], count, 0.5)
+                << "us p99<" << quantile(i->second[j], count, 0.99) << "us";
+        out << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Defines.h"
+
+namespace fcgi {
+
+// Stages are measured from previous one, so their sum is close to total.
+// Write is measured from handler end, so it includes asynchronous answers.
+enum TraceStage {
+    tsParse, // BEGIN_REQUEST read to posting request, includes waiting for params and stdin
+    tsQueue, // waiting in io_service queue
+    tsHandler,
+    tsWrite,
+    tsTotal,
+    tsCount,
+};
+
+typedef boost::array<nexus::LatencyHistogram, tsCount> TraceHistograms;
+typedef std::map<std::string, TraceHistograms> TraceSnapshot;
+
+// Per endpoint histograms of request stages, endpoint is SCRIPT_NAME param.
+// Number of endpoints is limited, requests of endpoints past the limit are counted as "<other>".
+// Requests with streamed bodies are not traced.
+class Tracer : public mstd::singleton<Tracer> {
+public:
+    // Should be called before server starts, connections check it once when created.
+    // Requests slower than slowThreshold are logged, zero disables slow log.
+    void enable(nexus::Microseconds slowThreshold);
+    bool enabled() const { return enabled_; }
+
+    // Called after handler end and after write completion, the last call records trace.
+    void release(Request & request);
+
+    TraceSnapshot snapshot();
+    void status(std::ostream & out);
+
+    ~Tracer();
+private:
+    Tracer();
+
+    void record(const Request & request);
+
+    struct Impl;
+    boost::scoped_ptr<Impl> impl_;
+    bool enabled_;
+    nexus::Microseconds slowThreshold_;
+
+    MSTD_SINGLETON_DECLARATION(Tracer);
+};
+
+}
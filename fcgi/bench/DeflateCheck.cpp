@@ -0,0 +1,142 @@
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <boost/asio.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <zlib.h>
+
+#include <mstd/atomic.hpp>
+#include <mstd/cstdint.hpp>
+#include <mstd/reference_counter.hpp>
+#include <mstd/singleton.hpp>
+
+#include <nexus/Buffer.h>
+#include <nexus/Clock.h>
+#include <nexus/Handler.h>
+
+#include <fcgi/Connection.h>
+#include <fcgi/Response.h>
+
+// Checks that compressed response carries Content-Encoding of the stream it was deflated to,
+// body is captured from connection and inflated with window bits of the announced encoding.
+namespace {
+
+void appendParam(std::vector<char> & out, const std::string & name, const std::string & value)
+{
+    out.push_back(static_cast<char>(name.length()));
+    out.push_back(static_cast<char>(value.length()));
+    out.insert(out.end(), name.begin(), name.end());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+void ignoreRequest(const fcgi::RequestPtr &, const fcgi::ConnectionPtr &)
+{
+}
+
+void collect(fcgi::Connection::Chunks & out, const fcgi::Connection::Chunks & chunks, uint32_t)
+{
+    out = chunks;
+}
+
+std::string makeBody()
+{
+    std::string result;
+    for(size_t i = 0; result.size() < 0x10000; ++i)
+        result += "{\"id\":" + boost::lexical_cast<std::string>(i) + ",\"name\":\"item\",\"price\":100},";
+    return result;
+}
+
+bool inflateBody(const std::string & input, int windowBits, std::string & output)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if(inflateInit2(&stream, windowBits) != Z_OK)
+        return false;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    char buffer[0x4000];
+    int result;
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        result = inflate(&stream, Z_NO_FLUSH);
+        output.append(buffer, sizeof(buffer) - stream.avail_out);
+    } while(result == Z_OK);
+    inflateEnd(&stream);
+    return result == Z_STREAM_END && !stream.avail_in;
+}
+
+// Sends body in several writes for given Accept-Encoding and checks what client would decode.
+bool check(boost::asio::io_service & ioService, const std::string & acceptEncoding, const char * expected, int windowBits)
+{
+    std::vector<char> params;
+    appendParam(params, "SCRIPT_NAME", "/api/items");
+    appendParam(params, "HTTP_ACCEPT_ENCODING", acceptEncoding);
+    fcgi::RequestPtr request(new fcgi::Request);
+    request->id = 1;
+    request->parseParams(params);
+
+    // socket is not connected, frames are only captured
+    boost::intrusive_ptr<fcgi::TcpConnection> conn(new fcgi::TcpConnection(ioService, &ignoreRequest));
+    fcgi::Connection::Chunks chunks;
+    conn->capture(request->id, boost::bind(&collect, boost::ref(chunks), _1, _2));
+
+    std::string body = makeBody();
+    {
+        fcgi::Response response(conn, request->id);
+        response.compress(*request);
+        for(size_t pos = 0; pos < body.size(); pos += 0x1000)
+            response.write(body.data() + pos, body.data() + std::min(body.size(), pos + 0x1000));
+        response.finish();
+    }
+
+    std::string output;
+    for(fcgi::Connection::Chunks::const_iterator i = chunks.begin(), end = chunks.end(); i != end; ++i)
+        output.append(i->data(), i->size());
+    std::string::size_type headersEnd = output.find("\r\n\r\n");
+    if(headersEnd == std::string::npos)
+    {
+        std::cerr << acceptEncoding << ": headers not found" << std::endl;
+        return false;
+    }
+    std::string headers = output.substr(0, headersEnd + 2);
+    std::string line = std::string("Content-Encoding: ") + expected + "\r\n";
+    if(headers.find(line) == std::string::npos)
+    {
+        std::cerr << acceptEncoding << ": expected " << expected << ", headers: " << headers << std::endl;
+        return false;
+    }
+
+    std::string decoded;
+    if(!inflateBody(output.substr(headersEnd + 4), windowBits, decoded) || decoded != body)
+    {
+        std::cerr << acceptEncoding << ": body does not inflate with window bits " << windowBits << std::endl;
+        return false;
+    }
+    std::cout << acceptEncoding << ": " << body.size() << " -> " << output.size() - headersEnd - 4 << std::endl;
+    return true;
+}
+
+}
+
+int main()
+{
+    boost::asio::io_service ioService;
+    bool ok = check(ioService, "gzip, deflate", "gzip", 16 + MAX_WBITS);
+    ok = check(ioService, "deflate", "deflate", MAX_WBITS) && ok;
+    std::cout << (ok ? "ok" : "failed") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,442 @@
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <boost/asio.hpp>
+
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/cstdint.hpp>
+#include <mstd/hton.hpp>
+#include <mstd/pointer_cast.hpp>
+#include <mstd/reference_counter.hpp>
+#include <mstd/singleton.hpp>
+
+#include <nexus/Buffer.h>
+#include <nexus/Clock.h>
+#include <nexus/Handler.h>
+#include <nexus/Socket.h>
+
+#include <fcgi/App.h>
+#include <fcgi/Connection.h>
+#include <fcgi/Parser.h>
+#include <fcgi/Server.h>
+
+namespace {
+
+const uint8_t FCGI_BEGIN_REQUEST = 1;
+const uint8_t FCGI_END_REQUEST = 3;
+const uint8_t FCGI_PARAMS = 4;
+const uint8_t FCGI_STDIN = 5;
+
+const uint8_t FCGI_KEEP_CONN = 1;
+
+// Sample application for fcgi::run, answers every request with short text.
+class EchoManager {
+public:
+    EchoManager(boost::asio::io_service &, const std::string & dbopts)
+        : port_(dbopts.empty() ? 9000 : boost::lexical_cast<unsigned short>(dbopts)) {}
+
+    unsigned short port() const
+    {
+        return port_;
+    }
+
+    void start()
+    {
+    }
+
+    void handle(const fcgi::Request & request, const fcgi::ConnectionPtr & conn)
+    {
+        conn->send(request, "Hello, FastCGI!");
+    }
+private:
+    unsigned short port_;
+};
+
+void appendRecord(std::vector<char> & out, uint8_t type, const char * content, size_t len)
+{
+    fcgi::FCGIRecord rec;
+    rec.version = 1;
+    rec.type = type;
+    rec.requestId = 0;
+    rec.contentLength = mstd::hton<uint16_t>(static_cast<uint16_t>(len));
+    rec.paddingLength = static_cast<uint8_t>((len + 7) / 8 * 8 - len);
+    rec.reserved = 0;
+    const char * header = mstd::pointer_cast<const char*>(&rec);
+    out.insert(out.end(), header, header + sizeof(rec));
+    out.insert(out.end(), content, content + len);
+    out.resize(out.size() + rec.paddingLength);
+}
+
+void appendParam(std::string & out, const std::string & name, const std::string & value)
+{
+    out += static_cast<char>(name.length());
+    out += static_cast<char>(value.length());
+    out += name;
+    out += value;
+}
+
+// Request records with zero request id, ids are patched at offsets of record headers.
+class RequestTemplate {
+public:
+    explicit RequestTemplate(bool keepAlive)
+    {
+        std::string params;
+        appendParam(params, "SCRIPT_NAME", "/echo");
+        appendParam(params, "QUERY_STRING", "id=12345");
+        appendParam(params, "REQUEST_METHOD", "GET");
+        appendParam(params, "SERVER_PROTOCOL", "HTTP/1.1");
+        appendParam(params, "REMOTE_ADDR", "127.0.0.1");
+        appendParam(params, "HTTP_HOST", "localhost");
+
+        const char begin[8] = { 0, 1, static_cast<char>(keepAlive ? FCGI_KEEP_CONN : 0), 0, 0, 0, 0, 0 };
+        add(FCGI_BEGIN_REQUEST, begin, sizeof(begin));
+        add(FCGI_PARAMS, params.c_str(), params.length());
+        add(FCGI_PARAMS, 0, 0);
+        add(FCGI_STDIN, 0, 0);
+    }
+
+    void append(std::vector<char> & out, fcgi::RequestId id) const
+    {
+        size_t start = out.size();
+        out.insert(out.end(), data_.begin(), data_.end());
+        fcgi::RequestId netId = mstd::hton(id);
+        for(std::vector<size_t>::const_iterator i = headers_.begin(), end = headers_.end(); i != end; ++i)
+            mstd::pointer_cast<fcgi::FCGIRecord*>(&out[start + *i])->requestId = netId;
+    }
+private:
+    void add(uint8_t type, const char * content, size_t len)
+    {
+        headers_.push_back(data_.size());
+        appendRecord(data_, type, content, len);
+    }
+
+    std::vector<char> data_;
+    std::vector<size_t> headers_;
+};
+
+struct Options {
+    size_t connections;
+    size_t requests;
+    size_t pipeline;
+    bool keepAlive;
+    size_t threads;
+};
+
+// Keeps pipeline requests in flight over one connection, or one request per connection without keep alive.
+template<class Protocol>
+class Client {
+public:
+    typedef typename Protocol::endpoint Endpoint;
+
+    Client(boost::asio::io_service & ioService, const Endpoint & endpoint, const Options & options,
+           const RequestTemplate & tmpl, size_t requests)
+        : socket_(ioService), endpoint_(endpoint), options_(options), template_(tmpl), total_(requests), left_(requests), writing_(false),
+          sent_(options.pipeline + 1), failed_(false)
+    {
+        latencies_.reserve(requests);
+    }
+
+    void start()
+    {
+        if(left_)
+            connect();
+    }
+
+    const std::vector<nexus::Microseconds> & latencies() const
+    {
+        return latencies_;
+    }
+
+    bool failed() const
+    {
+        return failed_;
+    }
+private:
+    void connect()
+    {
+        parser_.reset(new fcgi::Parser);
+        socket_.async_connect(endpoint_, boost::bind(&Client::handleConnect, this, boost::asio::placeholders::error));
+    }
+
+    void handleConnect(const boost::system::error_code & ec)
+    {
+        if(ec)
+        {
+            std::cerr << "connect failed: " << ec.message() << std::endl;
+            failed_ = true;
+            return;
+        }
+        fcgi::configureSocket(socket_);
+
+        size_t depth = options_.keepAlive ? std::min(options_.pipeline, left_) : 1;
+        for(size_t i = 1; i <= depth; ++i)
+            send(static_cast<fcgi::RequestId>(i));
+        startRead();
+    }
+
+    void send(fcgi::RequestId id)
+    {
+        --left_;
+        sent_[id] = nexus::Clock::microseconds();
+        template_.append(pending_, id);
+        if(!writing_)
+            startWrite();
+    }
+
+    void startWrite()
+    {
+        writing_ = true;
+        output_.swap(pending_);
+        pending_.clear();
+        boost::asio::async_write(socket_, boost::asio::buffer(output_),
+                                 boost::bind(&Client::handleWrite, this, boost::asio::placeholders::error));
+    }
+
+    void handleWrite(const boost::system::error_code & ec)
+    {
+        writing_ = false;
+        if(ec)
+        {
+            if(ec != boost::asio::error::operation_aborted)
+                std::cerr << "write failed: " << ec.message() << std::endl;
+            return;
+        }
+        if(!pending_.empty())
+            startWrite();
+    }
+
+    void startRead()
+    {
+        parser_->prepare(0x10000);
+        socket_.async_read_some(boost::asio::buffer(parser_->space(), parser_->spaceSize()),
+                                boost::bind(&Client::handleRead, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    }
+
+    void handleRead(const boost::system::error_code & ec, size_t len)
+    {
+        if(ec)
+        {
+            if(ec != boost::asio::error::operation_aborted)
+            {
+                std::cerr << "read failed: " << ec.message() << std::endl;
+                failed_ = true;
+            }
+            return;
+        }
+
+        parser_->commit(len);
+        fcgi::Record rec;
+        while(parser_->next(rec))
+        {
+            if(rec.type != FCGI_END_REQUEST)
+                continue;
+            latencies_.push_back(nexus::Clock::microseconds() - sent_[rec.id]);
+            if(!options_.keepAlive)
+            {
+                boost::system::error_code ignored;
+                socket_.close(ignored);
+                if(left_)
+                    connect();
+                return;
+            }
+            if(left_)
+                send(rec.id);
+        }
+        parser_->compact();
+        if(latencies_.size() != total_)
+            startRead();
+    }
+
+    typename Protocol::socket socket_;
+    Endpoint endpoint_;
+    const Options & options_;
+    const RequestTemplate & template_;
+    size_t total_;
+    size_t left_; // requests that were not sent yet
+    std::vector<char> pending_;
+    std::vector<char> output_;
+    bool writing_;
+    boost::scoped_ptr<fcgi::Parser> parser_;
+    std::vector<nexus::Microseconds> sent_; // indexed by request id
+    std::vector<nexus::Microseconds> latencies_;
+    bool failed_;
+};
+
+void nop()
+{
+}
+
+void runService(boost::asio::io_service * ioService)
+{
+    ioService->run();
+}
+
+nexus::Microseconds percentile(const std::vector<nexus::Microseconds> & sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+void echo(const fcgi::RequestPtr & request, const fcgi::ConnectionPtr & conn)
+{
+    conn->send(*request, "Hello, FastCGI!");
+}
+
+// Serves unix domain socket when argument is not a port.
+int serve(int argc, char * argv[])
+{
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if(argc > 1 && !isdigit(static_cast<unsigned char>(*argv[1])))
+    {
+        fcgi::AppContext context("fcgiload", argc, argv);
+        context.run(argv[1], &nop, &echo);
+        return 0;
+    }
+#endif
+    fcgi::run<EchoManager>("fcgiload", argc, argv);
+    return 0;
+}
+
+void parseOptions(Options & options, int argc, char * argv[])
+{
+    options.connections = argc > 0 ? boost::lexical_cast<size_t>(argv[0]) : 16;
+    options.requests = argc > 1 ? boost::lexical_cast<size_t>(argv[1]) : 100000;
+    options.pipeline = std::max<size_t>(argc > 2 ? boost::lexical_cast<size_t>(argv[2]) : 1, 1);
+    options.keepAlive = argc > 3 ? boost::lexical_cast<int>(argv[3]) != 0 : true;
+    options.threads = std::max<size_t>(argc > 4 ? boost::lexical_cast<size_t>(argv[4]) : 1, 1);
+    if(!options.keepAlive)
+        options.pipeline = 1;
+}
+
+template<class Protocol>
+void load(const typename Protocol::endpoint & endpoint, const char * transport, const Options & options)
+{
+    RequestTemplate tmpl(options.keepAlive);
+
+    // Clients of one io_service run in one thread, so they need no locking.
+    boost::ptr_vector<boost::asio::io_service> services;
+    for(size_t i = 0; i != options.threads; ++i)
+        services.push_back(new boost::asio::io_service);
+
+    boost::ptr_vector<Client<Protocol> > clients;
+    for(size_t i = 0; i != options.connections; ++i)
+    {
+        size_t share = options.requests / options.connections + (i < options.requests % options.connections ? 1 : 0);
+        clients.push_back(new Client<Protocol>(services[i % options.threads], endpoint, options, tmpl, share));
+        clients.back().start();
+    }
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    for(size_t i = 0; i != options.threads; ++i)
+        group.create_thread(boost::bind(&runService, &services[i]));
+    group.join_all();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    std::vector<nexus::Microseconds> latencies;
+    latencies.reserve(options.requests);
+    size_t failed = 0;
+    for(typename boost::ptr_vector<Client<Protocol> >::const_iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+    {
+        latencies.insert(latencies.end(), i->latencies().begin(), i->latencies().end());
+        if(i->failed())
+            ++failed;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << "{\"benchmark\":\"fcgi.load\",\"transport\":\"" << transport
+              << "\",\"connections\":" << options.connections
+              << ",\"pipeline\":" << options.pipeline
+              << ",\"keepalive\":" << (options.keepAlive ? "true" : "false")
+              << ",\"threads\":" << options.threads
+              << ",\"requests\":" << latencies.size()
+              << ",\"failed_connections\":" << failed
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"requests_per_second\":" << (elapsed ? latencies.size() * 1000000.0 / elapsed : 0.0)
+              << ",\"p50_us\":" << percentile(latencies, 0.5)
+              << ",\"p90_us\":" << percentile(latencies, 0.9)
+              << ",\"p99_us\":" << percentile(latencies, 0.99)
+              << ",\"p999_us\":" << percentile(latencies, 0.999)
+              << ",\"max_us\":" << (latencies.empty() ? 0 : latencies.back())
+              << '}' << std::endl;
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+// Runs same load against in-process server over loopback tcp and over unix domain socket.
+int compare(int argc, char * argv[])
+{
+    unsigned short port = argc > 1 ? boost::lexical_cast<unsigned short>(argv[1]) : 9000;
+    std::string path = argc > 2 ? argv[2] : "/tmp/fcgiload.sock";
+    Options options;
+    parseOptions(options, std::max(argc - 3, 0), argv + 3);
+
+    boost::asio::io_service ioService;
+    fcgi::Server server(ioService, &echo);
+    server.start(port);
+    server.start(path);
+
+    boost::thread_group group;
+    for(size_t i = 0; i != options.threads; ++i)
+        group.create_thread(boost::bind(&runService, &ioService));
+
+    load<boost::asio::ip::tcp>(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), "tcp", options);
+    load<boost::asio::local::stream_protocol>(boost::asio::local::stream_protocol::endpoint(path), "unix", options);
+
+    // closed acceptors and connections of finished clients complete their handlers, then threads return
+    server.stop();
+    group.join_all();
+    return 0;
+}
+#endif
+
+}
+
+int main(int argc, char * argv[])
+{
+    if(argc > 1 && !strcmp(argv[1], "serve"))
+        return serve(argc - 1, argv + 1);
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if(argc > 1 && !strcmp(argv[1], "compare"))
+        return compare(argc - 1, argv + 1);
+#endif
+
+    if(argc < 3)
+    {
+        std::cerr << "usage: fcgiload serve [port=9000|path]" << std::endl
+                  << "       fcgiload <host> <port> [connections=16] [requests=100000] [pipeline=1] [keepalive=1] [threads=1]" << std::endl
+                  << "       fcgiload unix <path> [connections=16] [requests=100000] [pipeline=1] [keepalive=1] [threads=1]" << std::endl
+                  << "       fcgiload compare [port=9000] [path=/tmp/fcgiload.sock] [connections=16] [requests=100000] [pipeline=1] [keepalive=1] [threads=1]" << std::endl;
+        return 1;
+    }
+
+    Options options;
+    parseOptions(options, argc - 3, argv + 3);
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if(!strcmp(argv[1], "unix"))
+    {
+        load<boost::asio::local::stream_protocol>(boost::asio::local::stream_protocol::endpoint(argv[2]), "unix", options);
+        return 0;
+    }
+#endif
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(argv[1]), boost::lexical_cast<unsigned short>(argv[2]));
+    load<boost::asio::ip::tcp>(endpoint, "tcp", options);
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/cstdint.hpp>
+#include <mstd/hton.hpp>
+#include <mstd/performance_timer.hpp>
+#include <mstd/pointer_cast.hpp>
+#include <mstd/reference_counter.hpp>
+#include <mstd/singleton.hpp>
+
+#include <nexus/Buffer.h>
+#include <nexus/Clock.h>
+
+#include <fcgi/Parser.h>
+
+namespace {
+
+mstd::atomic<size_t> heapBytes(0);
+mstd::atomic<size_t> heapBlocks(0);
+
+}
+
+void * operator new(size_t size)
+{
+    heapBytes += size;
+    ++heapBlocks;
+    void * result = malloc(size ? size : 1);
+    if(!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void operator delete(void * p) throw()
+{
+    free(p);
+}
+
+void * operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete[](void * p) throw()
+{
+    operator delete(p);
+}
+
+namespace {
+
+const uint8_t FCGI_BEGIN_REQUEST = 1;
+const uint8_t FCGI_PARAMS = 4;
+const uint8_t FCGI_STDIN = 5;
+
+const size_t readSize = 0x10000;
+
+void appendRecord(std::vector<char> & out, uint8_t type, fcgi::RequestId id, const char * content, size_t len)
+{
+    fcgi::FCGIRecord rec;
+    rec.version = 1;
+    rec.type = type;
+    rec.requestId = mstd::hton(id);
+    rec.contentLength = mstd::hton<uint16_t>(static_cast<uint16_t>(len));
+    rec.paddingLength = static_cast<uint8_t>((len + 7) / 8 * 8 - len);
+    rec.reserved = 0;
+    const char * header = mstd::pointer_cast<const char*>(&rec);
+    out.insert(out.end(), header, header + sizeof(rec));
+    out.insert(out.end(), content, content + len);
+    out.resize(out.size() + rec.paddingLength);
+}
+
+void appendParam(std::string & out, const std::string & name, const std::string & value)
+{
+    out += static_cast<char>(name.length());
+    out += static_cast<char>(value.length());
+    out += name;
+    out += value;
+}
+
+// Small keep-alive GET requests as nginx pipelines them: BEGIN, single PARAMS record, empty PARAMS and STDIN.
+std::vector<char> makeStream(size_t requests)
+{
+    std::string params;
+    appendParam(params, "SCRIPT_NAME", "/api/item");
+    appendParam(params, "QUERY_STRING", "id=12345&fields=name,price");
+    appendParam(params, "REQUEST_METHOD", "GET");
+    appendParam(params, "SERVER_PROTOCOL", "HTTP/1.1");
+    appendParam(params, "REMOTE_ADDR", "10.0.0.17");
+    appendParam(params, "REMOTE_PORT", "51234");
+    appendParam(params, "HTTP_HOST", "example.com");
+    appendParam(params, "HTTP_USER_AGENT", "Mozilla/5.0 (X11; Linux x86_64)");
+
+    const char begin[8] = { 0, 1, 1, 0, 0, 0, 0, 0 };
+    std::vector<char> result;
+    for(size_t i = 0; i != requests; ++i)
+    {
+        fcgi::RequestId id = static_cast<fcgi::RequestId>(i % 0x40 + 1);
+        appendRecord(result, FCGI_BEGIN_REQUEST, id, begin, sizeof(begin));
+        appendRecord(result, FCGI_PARAMS, id, params.c_str(), params.length());
+        appendRecord(result, FCGI_PARAMS, id, 0, 0);
+        appendRecord(result, FCGI_STDIN, id, 0, 0);
+    }
+    return result;
+}
+
+struct Result {
+    const char * parser;
+    size_t requests;
+    size_t bytes;
+    double nanoseconds;
+    double heapBytes;
+    double heapBlocks;
+};
+
+class Measure {
+public:
+    Measure()
+        : heapBytes_(heapBytes), heapBlocks_(heapBlocks) {}
+
+    void finish(Result & result)
+    {
+        mstd::performance_mark stop;
+        double n = static_cast<double>(result.requests);
+        result.nanoseconds = (stop - start_).nanoseconds() / n;
+        result.heapBytes = (heapBytes - heapBytes_) / n;
+        result.heapBlocks = (heapBlocks - heapBlocks_) / n;
+    }
+private:
+    size_t heapBytes_;
+    size_t heapBlocks_;
+    mstd::performance_mark start_;
+};
+
+// Previous Connection::processRecords: shifts buffer after every record and copies content to stream.
+Result benchShift(const std::vector<char> & input, size_t requests, size_t iterations)
+{
+    Result result = { "shift", requests * iterations, input.size(), 0, 0, 0 };
+    std::vector<char> buffer(readSize * 2);
+    std::vector<char> stream;
+    size_t checksum = 0;
+    Measure measure;
+    for(size_t it = 0; it != iterations; ++it)
+    {
+        size_t pos = 0;
+        for(size_t offset = 0; offset < input.size();)
+        {
+            size_t bt = std::min(readSize, input.size() - offset);
+            memcpy(&buffer[pos], &input[offset], bt);
+            offset += bt;
+            pos += bt;
+            while(pos >= sizeof(fcgi::FCGIRecord))
+            {
+                const fcgi::FCGIRecord * rec = mstd::pointer_cast<const fcgi::FCGIRecord*>(&buffer[0]);
+                size_t len = mstd::ntoh(rec->contentLength);
+                size_t recordLen = sizeof(*rec) + len + rec->paddingLength;
+                if(pos < recordLen)
+                    break;
+                if(len)
+                    stream.insert(stream.end(), &buffer[0] + sizeof(*rec), &buffer[0] + sizeof(*rec) + len);
+                else {
+                    checksum += stream.size();
+                    std::vector<char>().swap(stream);
+                }
+                memmove(&buffer[0], &buffer[0] + recordLen, pos - recordLen);
+                pos -= recordLen;
+            }
+        }
+    }
+    measure.finish(result);
+    BOOST_ASSERT(checksum);
+    return result;
+}
+
+Result benchCursor(const std::vector<char> & input, size_t requests, size_t iterations)
+{
+    Result result = { "cursor", requests * iterations, input.size(), 0, 0, 0 };
+    fcgi::Parser parser;
+    size_t checksum = 0;
+    Measure measure;
+    for(size_t it = 0; it != iterations; ++it)
+    {
+        const char * slice = 0;
+        size_t sliceLen = 0;
+        for(size_t offset = 0; offset < input.size();)
+        {
+            parser.prepare(readSize);
+            size_t bt = std::min(parser.spaceSize(), input.size() - offset);
+            memcpy(parser.space(), &input[offset], bt);
+            parser.commit(bt);
+            offset += bt;
+            fcgi::Record rec;
+            while(parser.next(rec))
+            {
+                if(rec.length)
+                {
+                    slice = rec.content;
+                    sliceLen = rec.length;
+                } else {
+                    checksum += slice ? sliceLen : 0;
+                    slice = 0;
+                }
+            }
+            parser.compact();
+        }
+    }
+    measure.finish(result);
+    BOOST_ASSERT(checksum);
+    return result;
+}
+
+void output(std::ostream & out, const std::vector<Result> & results)
+{
+    out << "{\"benchmark\":\"fcgi.parser\",\"clock\":\"thread_cputime\",\"results\":[";
+    for(std::vector<Result>::const_iterator i = results.begin(), end = results.end(); i != end; ++i)
+    {
+        if(i != results.begin())
+            out << ',';
+        out << "{\"parser\":\"" << i->parser << "\""
+            << ",\"requests\":" << i->requests
+            << ",\"stream_bytes\":" << i->bytes
+            << ",\"ns_per_request\":" << i->nanoseconds
+            << ",\"heap_bytes_per_request\":" << i->heapBytes
+            << ",\"heap_allocations_per_request\":" << i->heapBlocks
+            << '}';
+    }
+    out << "]}" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t requests = argc > 1 ? boost::lexical_cast<size_t>(argv[1]) : 1000;
+    size_t iterations = argc > 2 ? boost::lexical_cast<size_t>(argv[2]) : 1000;
+
+    std::vector<char> input = makeStream(requests);
+
+    std::vector<Result> results;
+    results.push_back(benchShift(input, requests, iterations));
+    results.push_back(benchCursor(input, requests, iterations));
+
+    output(std::cout, results);
+
+    return 0;
+}
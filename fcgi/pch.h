@@ -2,29 +2,60 @@
 #pragma once
 #endif
 
+#include <deque>
+#include <list>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+
+#if !defined(BOOST_WINDOWS)
+#include <sys/stat.h>
+#endif
+
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/bind.hpp>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/optional.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <boost/algorithm/string.hpp>
 
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <boost/functional/hash.hpp>
+
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
 #include <boost/utility/in_place_factory.hpp>
 
+#include <zlib.h>
+
+#include <mstd/atomic.hpp>
 #include <mstd/cstdint.hpp>
 #include <mstd/hton.hpp>
+#include <mstd/itoa.hpp>
 #include <mstd/reference_counter.hpp>
+#include <mstd/singleton.hpp>
+#include <mstd/tss.hpp>
 
 #include <mlog/Dumper.h>
 #include <mlog/Logging.h>
 #include <mlog/Utils.h>
 
 #include <nexus/Buffer.h>
+#include <nexus/Clock.h>
 #include <nexus/Handler.h>
 #include <nexus/IoThreadPool.h>
 #include <nexus/PacketReader.h>
 #include <nexus/Signals.h>
 #include <nexus/Socket.h>
+#include <nexus/StackStream.h>
+#include <nexus/Stats.h>
 #include <nexus/Utils.h>
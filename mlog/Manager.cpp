@@ -515,11 +515,7 @@ void Manager::output(const char * logger, const mstd::pbuffer & buf)
         boost::lock_guard<boost::mutex> lock(mutex_);
         queue_.push_back(Queue::value_type(logger, buf));
         cond_.notify_one();
-        if(!threadStarted_)
-        {
-            threadStarted_ = true;
-            thread_ = boost::thread(&Manager::execute, this);
-        }
+        startThread();
     } else {
         SharedDevices devices;
         {
@@ -576,6 +572,25 @@ void Manager::process(Devices & devices, const char * logger, const mstd::pbuffe
     }
 }
 
+bool Manager::outputThread(boost::thread::native_handle_type & handle)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if(!realtime_)
+        return false;
+    startThread();
+    handle = thread_.native_handle();
+    return true;
+}
+
+void Manager::startThread()
+{
+    if(!threadStarted_)
+    {
+        threadStarted_ = true;
+        thread_ = boost::thread(&Manager::execute, this);
+    }
+}
+
 void Manager::execute()
 {
     Queue queue;
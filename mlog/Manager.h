@@ -107,6 +107,10 @@ public:
     void setup(const std::string & expr);
     void output(const char * logger, const mstd::pbuffer & buf);
     void setListener(LogLevel level, const Listener & listener);
+
+    // Starts output thread of realtime logging, so it inherits affinity of caller, and returns its handle.
+    // Returns false when logging is not realtime, i.e. messages are written by threads that log them.
+    bool outputThread(boost::thread::native_handle_type & handle);
 private:
     Manager();
 
@@ -114,6 +118,7 @@ private:
     void setupGroup(const std::string & name, const std::string & value, boost::unique_lock<boost::mutex> & lock);
     void setupDevice(const std::string & prop, const std::string & value, boost::unique_lock<boost::mutex> & lock);
     void execute();
+    void startThread();
 
     template<class F>
     void setup(const std::string & name, const F & f, boost::unique_lock<boost::mutex> & lock);
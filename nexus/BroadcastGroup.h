@@ -0,0 +1,158 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <boost/asio/io_service.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/threads.hpp>
+
+#endif
+
+#include "Config.h"
+
+#include "Buffer.h"
+
+namespace nexus {
+
+// Set of connections that receive the same buffers.
+// Members are partitioned into shards by io_service, publish posts a single task per shard,
+// that task queues the buffer to all shard members in one pass.
+// Conn should provide send(const Buffer &), like nexus::Connection.
+// Member should be removed before it is destroyed, i.e. from its finish().
+// Removal from send() of publishing task is deferred until the task ends, member is not sent to after that.
+template<class Conn>
+class BroadcastGroup : public boost::noncopyable {
+public:
+    explicit BroadcastGroup(size_t shardLimit = 0x400)
+        : shardLimit_(shardLimit) {}
+
+    void add(Conn * conn, boost::asio::io_service & service)
+    {
+        Shards shards = servedBy(&service);
+        for(typename Shards::const_iterator i = shards.begin(), end = shards.end(); i != end; ++i)
+        {
+            Shard & shard = **i;
+            boost::mutex::scoped_lock shardLock(shard.mutex);
+            if(shard.members.size() < shardLimit_)
+            {
+                shard.members.push_back(conn);
+                return;
+            }
+        }
+        ShardPtr shard(new Shard(service));
+        shard->members.push_back(conn);
+        boost::mutex::scoped_lock lock(mutex_);
+        shards_.push_back(shard);
+    }
+
+    void remove(Conn * conn, boost::asio::io_service & service)
+    {
+        Shards shards = servedBy(&service);
+        for(typename Shards::const_iterator i = shards.begin(), end = shards.end(); i != end; ++i)
+        {
+            Shard & shard = **i;
+            if(shard.publisher == mstd::this_thread_id())
+                shard.removed.push_back(conn);
+            else {
+                boost::mutex::scoped_lock shardLock(shard.mutex);
+                if(shard.erase(conn))
+                    return;
+            }
+        }
+    }
+
+    size_t size()
+    {
+        size_t result = 0;
+        Shards shards = servedBy(0);
+        for(typename Shards::const_iterator i = shards.begin(), end = shards.end(); i != end; ++i)
+        {
+            boost::mutex::scoped_lock shardLock((*i)->mutex);
+            result += (*i)->members.size();
+        }
+        return result;
+    }
+
+    void publish(const Buffer & buffer)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        for(typename Shards::const_iterator i = shards_.begin(), end = shards_.end(); i != end; ++i)
+            (*i)->service->post(Publish(*i, buffer));
+    }
+private:
+    typedef std::vector<Conn*> Members;
+
+    struct Shard {
+        boost::asio::io_service * service;
+        boost::mutex mutex;
+        Members members;
+        mstd::atomic<mstd::thread_id> publisher; // thread that runs publish task, zero if none
+        Members removed; // removed by publisher while it sends, accessed by publisher only
+
+        explicit Shard(boost::asio::io_service & s)
+            : service(&s), publisher(0) {}
+
+        bool erase(Conn * conn)
+        {
+            typename Members::iterator i = std::find(members.begin(), members.end(), conn);
+            if(i == members.end())
+                return false;
+            *i = members.back();
+            members.pop_back();
+            return true;
+        }
+    };
+
+    typedef boost::shared_ptr<Shard> ShardPtr;
+    typedef std::vector<ShardPtr> Shards;
+
+    // Holds shard, so pending tasks stay valid after group is destroyed.
+    class Publish {
+    public:
+        Publish(const ShardPtr & shard, const Buffer & buffer)
+            : shard_(shard), buffer_(buffer) {}
+
+        void operator()() const
+        {
+            Shard & shard = *shard_;
+            boost::mutex::scoped_lock lock(shard.mutex);
+            shard.publisher = mstd::this_thread_id();
+            for(typename Members::const_iterator i = shard.members.begin(), end = shard.members.end(); i != end; ++i)
+                if(shard.removed.empty() || std::find(shard.removed.begin(), shard.removed.end(), *i) == shard.removed.end())
+                    (*i)->send(buffer_);
+            shard.publisher = 0;
+            for(typename Members::const_iterator i = shard.removed.begin(), end = shard.removed.end(); i != end; ++i)
+                shard.erase(*i);
+            shard.removed.clear();
+        }
+    private:
+        ShardPtr shard_;
+        Buffer buffer_;
+    };
+
+    // Shard locks are taken without group lock, so that send() of publishing task could remove members.
+    Shards servedBy(boost::asio::io_service * service)
+    {
+        Shards result;
+        boost::mutex::scoped_lock lock(mutex_);
+        for(typename Shards::const_iterator i = shards_.begin(), end = shards_.end(); i != end; ++i)
+            if(!service || (*i)->service == service)
+                result.push_back(*i);
+        return result;
+    }
+
+    size_t shardLimit_;
+    boost::mutex mutex_;
+    Shards shards_;
+};
+
+}
@@ -64,6 +64,12 @@ public:
 
     boost::asio::const_buffer make(size_t skip) const;
     
+    // Buffer is not referenced by other Buffer objects, so it could be changed in place.
+    bool unique() const
+    {
+        return buffer_ && buffer_->get_current_number_of_references() == 1;
+    }
+
     void swap(nexus::Buffer & rhs)
     {
         buffer_.swap(rhs.buffer_);
@@ -17,7 +17,7 @@ BuffersRef::BuffersRef(const Buffers & source)
 }
 
 Buffers::Buffers()
-    : skip_(0), total_(0) {}
+    : inGroup_(false), skip_(0), total_(0), sealed_(0) {}
 
 void Buffers::erase(size_t len)
 {
@@ -44,6 +44,13 @@ void Buffers::erase(size_t len)
         }
     }
 
+    size_t erased = i - begin;
+    if(erased)
+    {
+        inGroup_ = joined_[erased - 1];
+        joined_.erase(joined_.begin(), joined_.begin() + erased);
+    }
+    sealed_ -= std::min<size_t>(sealed_, erased);
     buffers_.erase(begin, i);
 }
 
@@ -4,6 +4,8 @@
 
 #include <deque>
 
+#include <boost/array.hpp>
+
 #include <boost/asio/buffer.hpp>
 
 #endif
@@ -77,6 +79,7 @@ public:
     {
         total_ += buffer.size();
         buffers_.push_back(buffer);
+        joined_.push_back(false);
     }
 
     bool empty() const
@@ -87,8 +90,11 @@ public:
     void clear()
     {
         buffers_.clear();
+        joined_.clear();
         total_ = 0;
         skip_ = 0;
+        sealed_ = 0;
+        inGroup_ = false;
     }
 
     size_t total() const
@@ -96,33 +102,78 @@ public:
         return total_;
     }
 
+    // Buffers of container form single frame, so they are written without switching to other lane.
     template<class Container>
     void add(const Container & container)
     {
+        if(container.empty())
+            return;
         buffers_.insert(buffers_.end(), container.begin(), container.end());
         for(typename Container::const_iterator i = container.begin(), end = container.end(); i != end; ++i)
+        {
             total_ += i->size();
+            joined_.push_back(true);
+        }
+        joined_.back() = false;
     }
 
     void erase(size_t len);
 
+    // Applies f(buffer, last) to buffers that next ref() would contain and that were not sealed before,
+    // last is false for buffer that is followed by the rest of its frame.
+    template<class F>
+    void seal(const F & f)
+    {
+        size_t count = std::min<size_t>(buffers_.size(), BuffersRef::Value::static_size);
+        for(; sealed_ < count; ++sealed_)
+            f(buffers_[sealed_], !joined_[sealed_]);
+    }
+
     BuffersRef ref() const
     {
         return BuffersRef(*this);
     }
 
+    // Front buffer was partially written, or it continues frame whose part was written,
+    // so switching to other buffers would break framing.
+    bool partial() const
+    {
+        return skip_ != 0 || inGroup_;
+    }
+
+    // Buffers were processed by seal() in advance, so other buffers should not be written before them.
+    bool sealed() const
+    {
+        return sealed_ != 0;
+    }
+
     bool mayAdd() const
     {
         return buffers_.size() < BuffersRef::Value::static_size;
     }
 private:
     std::deque<Buffer> buffers_;
+    std::deque<bool> joined_; // buffer and the next one belong to the same frame
+    bool inGroup_; // written buffer was joined with front one
     size_t skip_;
     size_t total_;
+    size_t sealed_;
 
     friend class BuffersRef;
 };
 
+// Lane to write next, switches to the highest non empty lane only when current one is at frame boundary
+// and has no sealed buffers. At least one lane should not be empty.
+template<size_t n>
+size_t nextLane(const boost::array<Buffers, n> & lanes, size_t current)
+{
+    if(lanes[current].partial() || lanes[current].sealed())
+        return current;
+    size_t result = n;
+    while(lanes[--result].empty());
+    return result;
+}
+
 class NEXUS_DECL SingleBuffer {
 public:
     explicit SingleBuffer(const Buffer & buffer)
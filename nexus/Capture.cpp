@@ -0,0 +1,164 @@
+#include "pch.h"
+
+#include "Capture.h"
+
+MLOG_DECLARE_LOGGER(nexus_capture);
+
+namespace nexus {
+
+namespace {
+
+const char captureMagic[4] = { 'N', 'X', 'C', '1' };
+
+#pragma pack(push)
+#pragma pack(1)
+struct FrameHeader {
+    boost::uint32_t connection;
+    boost::uint8_t direction;
+    boost::int64_t time;
+    boost::uint32_t len;
+};
+#pragma pack(pop)
+
+}
+
+struct TrafficRecorder::Impl {
+    FILE * file;
+    size_t limit;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<char> pending;
+    std::set<boost::uint32_t> unmarked; // connections that lost frames while there was no room for marker
+    bool stopping;
+    mstd::atomic<boost::uint32_t> connections;
+    mstd::atomic<size_t> dropped;
+    boost::thread thread;
+
+    Impl(const std::string & path, size_t l)
+        : file(fopen(path.c_str(), "wb")), limit(l), stopping(false), connections(0), dropped(0)
+    {
+        if(!file)
+            BOOST_THROW_EXCEPTION(CaptureException() << mstd::error_message("failed to open capture: " + path));
+        fwrite(captureMagic, sizeof(captureMagic), 1, file);
+        thread = boost::move(boost::thread(&Impl::execute, this));
+    }
+
+    ~Impl()
+    {
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            stopping = true;
+        }
+        cond.notify_one();
+        thread.join();
+        fclose(file);
+    }
+
+    void execute()
+    {
+        std::vector<char> current;
+        boost::mutex::scoped_lock lock(mutex);
+        for(;;)
+        {
+            while(pending.empty() && !stopping)
+                cond.wait(lock);
+            if(pending.empty())
+                break;
+            current.swap(pending);
+            lock.unlock();
+            if(fwrite(&current[0], current.size(), 1, file) != 1)
+                MLOG_MESSAGE(Error, "capture write failed: " << errno);
+            current.clear();
+            lock.lock();
+        }
+        fflush(file);
+    }
+};
+
+TrafficRecorder::TrafficRecorder(const std::string & path, size_t limit)
+    : impl_(new Impl(path, limit))
+{
+}
+
+TrafficRecorder::~TrafficRecorder()
+{
+}
+
+boost::uint32_t TrafficRecorder::connection()
+{
+    return ++impl_->connections;
+}
+
+void TrafficRecorder::record(boost::uint32_t connection, CaptureDirection direction, const char * data, size_t len)
+{
+    FrameHeader header = { connection, static_cast<boost::uint8_t>(direction), Clock::microseconds(), static_cast<boost::uint32_t>(len) };
+    const char * begin = mstd::pointer_cast<const char*>(&header);
+
+    bool notify;
+    {
+        boost::mutex::scoped_lock lock(impl_->mutex);
+        std::vector<char> & pending = impl_->pending;
+        std::set<boost::uint32_t>::iterator unmarked = impl_->unmarked.find(connection);
+        if(unmarked != impl_->unmarked.end() || pending.size() + sizeof(header) + len > impl_->limit)
+        {
+            // Frame is dropped even if it fits after earlier loss, so marker precedes later frames.
+            ++impl_->dropped;
+            if(pending.size() + sizeof(header) > impl_->limit)
+            {
+                impl_->unmarked.insert(connection);
+                return;
+            }
+            if(unmarked != impl_->unmarked.end())
+                impl_->unmarked.erase(unmarked);
+            header.direction = cdDropped;
+            header.len = 0;
+            notify = pending.empty();
+            pending.insert(pending.end(), begin, begin + sizeof(header));
+        } else {
+            notify = pending.empty();
+            pending.insert(pending.end(), begin, begin + sizeof(header));
+            pending.insert(pending.end(), data, data + len);
+        }
+    }
+    if(notify)
+        impl_->cond.notify_one();
+}
+
+size_t TrafficRecorder::dropped()
+{
+    return impl_->dropped;
+}
+
+TrafficReader::TrafficReader(const std::string & path)
+    : file_(fopen(path.c_str(), "rb"))
+{
+    if(!file_)
+        BOOST_THROW_EXCEPTION(CaptureException() << mstd::error_message("failed to open capture: " + path));
+    char magic[sizeof(captureMagic)];
+    if(fread(magic, sizeof(magic), 1, file_) != 1 || memcmp(magic, captureMagic, sizeof(magic)))
+    {
+        fclose(file_);
+        BOOST_THROW_EXCEPTION(CaptureException() << mstd::error_message("invalid capture: " + path));
+    }
+}
+
+TrafficReader::~TrafficReader()
+{
+    fclose(file_);
+}
+
+bool TrafficReader::next(CapturedFrame & frame)
+{
+    FrameHeader header;
+    if(fread(&header, sizeof(header), 1, file_) != 1)
+        return false;
+    frame.connection = header.connection;
+    frame.direction = static_cast<CaptureDirection>(header.direction);
+    frame.time = header.time;
+    frame.data.resize(header.len);
+    if(header.len && fread(&frame.data[0], header.len, 1, file_) != 1)
+        BOOST_THROW_EXCEPTION(CaptureException() << mstd::error_message("truncated capture frame"));
+    return true;
+}
+
+}
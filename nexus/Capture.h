@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/cstdint.hpp>
+#include <mstd/exception.hpp>
+
+#endif
+
+#include "Config.h"
+
+#include "Buffer.h"
+#include "Clock.h"
+
+namespace nexus {
+
+class CaptureTag;
+typedef mstd::own_exception<CaptureTag> CaptureException;
+
+enum CaptureDirection {
+    cdIncoming,
+    cdOutgoing,
+    cdDropped // empty marker, frames of connection were dropped here, so its stream is incomplete
+};
+
+struct CapturedFrame {
+    boost::uint32_t connection;
+    CaptureDirection direction;
+    Microseconds time;
+    std::vector<char> data;
+};
+
+// Writes timestamped connection traffic to a binary file, both directions are recorded as plaintext.
+// record() only appends to memory, file is written by background thread.
+// When writer falls behind more than limit bytes, frames are dropped and counted,
+// connection that lost frames gets cdDropped marker as soon as it fits, so replay could skip it.
+class NEXUS_DECL TrafficRecorder : public boost::noncopyable {
+public:
+    explicit TrafficRecorder(const std::string & path, size_t limit = 0x4000000);
+    ~TrafficRecorder();
+
+    boost::uint32_t connection();
+
+    void record(boost::uint32_t connection, CaptureDirection direction, const char * data, size_t len);
+
+    size_t dropped();
+private:
+    struct Impl;
+    boost::scoped_ptr<Impl> impl_;
+};
+
+class NEXUS_DECL TrafficReader : public boost::noncopyable {
+public:
+    explicit TrafficReader(const std::string & path);
+    ~TrafficReader();
+
+    bool next(CapturedFrame & frame);
+private:
+    FILE * file_;
+};
+
+}
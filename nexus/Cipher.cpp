@@ -0,0 +1,140 @@
+#include "pch.h"
+
+#include "Cipher.h"
+
+namespace nexus {
+
+CryptCipher::CryptCipher()
+{
+    init(std::vector<unsigned char>(8), std::vector<unsigned char>(8));
+}
+
+void CryptCipher::init(const std::vector<unsigned char> & outKey, const std::vector<unsigned char> & inKey)
+{
+    out_.init(outKey);
+    in_.init(inKey);
+    outFrame_ = 0;
+}
+
+void CryptCipher::encrypt(char * data, size_t len, bool)
+{
+    unsigned char * i = reinterpret_cast<unsigned char*>(data), * end = i + len;
+    while(i != end)
+    {
+        if(!outFrame_)
+        {
+            // header could be split between buffers, so it is collected byte by byte
+            outHeader_[out_.pos] = *i;
+            *i = out_.last = *i ^ out_.key[out_.pos & out_.mask] ^ out_.last;
+            ++i;
+            ++out_.pos;
+            if(out_.pos == 3 || out_.pos == 5)
+            {
+                boost::uint16_t low;
+                memcpy(&low, outHeader_ + 1, sizeof(low));
+                if(!(low & 0x8000))
+                    outFrame_ = 3 + low;
+                else if(out_.pos == 5)
+                {
+                    boost::uint16_t high;
+                    memcpy(&high, outHeader_ + 3, sizeof(high));
+                    outFrame_ = 5 + ((static_cast<size_t>(high) << 15) | (low & 0x7fff));
+                }
+            }
+        } else {
+            unsigned char * stop = i + std::min<size_t>(end - i, outFrame_ - out_.pos);
+            for(; i != stop; ++i, ++out_.pos)
+                *i = out_.last = *i ^ out_.key[out_.pos & out_.mask] ^ out_.last;
+        }
+        if(outFrame_ && out_.pos == outFrame_)
+        {
+            out_.finish();
+            outFrame_ = 0;
+        }
+    }
+}
+
+size_t CryptCipher::decrypt(char * data, size_t len)
+{
+    size_t done = 0;
+    while(len - done >= 3)
+    {
+        unsigned char * frame = reinterpret_cast<unsigned char*>(data + done);
+        size_t left = len - done;
+
+        // header is decrypted aside, so incomplete frame stays encrypted till next read
+        unsigned char header[5];
+        size_t headerLen = std::min<size_t>(left, sizeof(header));
+        unsigned char last = 0;
+        for(size_t j = 0; j != headerLen; ++j)
+        {
+            header[j] = frame[j] ^ in_.key[j & in_.mask] ^ last;
+            last = frame[j];
+        }
+        boost::uint16_t low;
+        memcpy(&low, header + 1, sizeof(low));
+        size_t frameLen = 3 + low;
+        if(low & 0x8000)
+        {
+            if(headerLen < 5)
+                break;
+            boost::uint16_t high;
+            memcpy(&high, header + 3, sizeof(high));
+            frameLen = 5 + ((static_cast<size_t>(high) << 15) | (low & 0x7fff));
+        }
+        if(frameLen > left)
+            break;
+
+        for(unsigned char * i = frame, * end = frame + frameLen; i != end; ++i, ++in_.pos)
+        {
+            unsigned char value = *i;
+            *i = value ^ in_.key[in_.pos & in_.mask] ^ in_.last;
+            in_.last = value;
+        }
+        in_.finish();
+        done += frameLen;
+    }
+    return done;
+}
+
+void CryptCipher::State::init(const std::vector<unsigned char> & k)
+{
+    BOOST_ASSERT(k.size() >= 8 && !(k.size() & (k.size() - 1)));
+    key = k;
+    mask = key.size() - 1;
+    pos = 0;
+    last = 0;
+}
+
+// Same as end of Crypt::encrypt and Crypt::decrypt, message size is added to last bytes of key.
+void CryptCipher::State::finish()
+{
+    size_t value;
+    memcpy(&value, &key[key.size() - 8], sizeof(value));
+    value += pos;
+    memcpy(&key[key.size() - 8], &value, sizeof(value));
+    pos = 0;
+    last = 0;
+}
+
+ChainCipher::ChainCipher()
+{
+    init(std::vector<unsigned char>(1), std::vector<unsigned char>(1));
+}
+
+void ChainCipher::init(const std::vector<unsigned char> & outKey, const std::vector<unsigned char> & inKey)
+{
+    out_.init(outKey);
+    in_.init(inKey);
+}
+
+void ChainCipher::State::init(const std::vector<unsigned char> & k)
+{
+    BOOST_ASSERT(!k.empty() && !(k.size() & (k.size() - 1)));
+    key = k;
+    mask = key.size() - 1;
+    pos = 0;
+    last = 0;
+}
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <vector>
+
+#endif
+
+#include "Config.h"
+
+#include "Buffer.h"
+
+namespace nexus {
+
+// Cipher policies for Connection, outgoing buffers are encrypted in place right before write,
+// buffers that are still referenced elsewhere are copied first, last is set for buffer that ends frame.
+// Incoming data is decrypted in place before processPackets, decrypt returns size of decrypted prefix,
+// the rest is passed again with next read.
+class NoCipher {
+public:
+    static const bool enabled = false;
+
+    void encrypt(char *, size_t, bool) {}
+    size_t decrypt(char *, size_t len) { return len; }
+};
+
+// Wire compatible with mcrypt::Crypt used by clients, every packCSD frame is one Crypt message:
+// chaining restarts at frame start and frame size is added to key after it.
+// Outgoing frame boundaries are taken from plaintext headers, so buffer could contain several frames,
+// i.e. committed LazyBuffer, or part of frame. Incoming frames are decrypted once complete.
+// Key size should be power of two and at least 8.
+class NEXUS_DECL CryptCipher {
+public:
+    static const bool enabled = true;
+
+    CryptCipher();
+
+    void init(const std::vector<unsigned char> & outKey, const std::vector<unsigned char> & inKey);
+
+    void encrypt(char * data, size_t len, bool);
+    size_t decrypt(char * data, size_t len);
+private:
+    struct State {
+        std::vector<unsigned char> key;
+        size_t mask;
+        size_t pos;
+        unsigned char last;
+
+        void init(const std::vector<unsigned char> & k);
+        void finish();
+    };
+
+    State out_;
+    State in_;
+    size_t outFrame_; // size of outgoing frame, 0 till its header is encrypted
+    unsigned char outHeader_[5];
+};
+
+// Chaining of mcrypt::Crypt, each byte is xored with key and previous encrypted byte.
+// Unlike Crypt, state is carried over calls, so result does not depend on how stream is split
+// into writes and reads. Key size should be power of two.
+// Not compatible with Crypt clients, peer should use the same chaining.
+class NEXUS_DECL ChainCipher {
+public:
+    static const bool enabled = true;
+
+    ChainCipher();
+
+    void init(const std::vector<unsigned char> & outKey, const std::vector<unsigned char> & inKey);
+
+    void encrypt(char * data, size_t len, bool)
+    {
+        unsigned char * i = reinterpret_cast<unsigned char*>(data), * end = i + len;
+        for(; i != end; ++i, ++out_.pos)
+            *i = out_.last = *i ^ out_.key[out_.pos & out_.mask] ^ out_.last;
+    }
+
+    size_t decrypt(char * data, size_t len)
+    {
+        unsigned char * i = reinterpret_cast<unsigned char*>(data), * end = i + len;
+        for(; i != end; ++i, ++in_.pos)
+        {
+            unsigned char value = *i;
+            *i = value ^ in_.key[in_.pos & in_.mask] ^ in_.last;
+            in_.last = value;
+        }
+        return len;
+    }
+private:
+    struct State {
+        std::vector<unsigned char> key;
+        size_t mask;
+        size_t pos;
+        unsigned char last;
+
+        void init(const std::vector<unsigned char> & k);
+    };
+
+    State out_;
+    State in_;
+};
+
+// Buffers::seal functor, shared buffer, i.e. posted to several connections, is copied before
+// it is encrypted, so others do not see ciphertext.
+template<class Cipher>
+class Encrypt {
+public:
+    explicit Encrypt(Cipher & cipher)
+        : cipher_(cipher) {}
+
+    void operator()(Buffer & buffer, bool last) const
+    {
+        if(!buffer.unique())
+            Buffer(buffer.data(), buffer.size()).swap(buffer);
+        cipher_.encrypt(buffer.data(), buffer.size(), last);
+    }
+private:
+    Cipher & cipher_;
+};
+
+}
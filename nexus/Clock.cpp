@@ -68,6 +68,11 @@ Milliseconds Clock::milliseconds()
     return out;
 }
 
+Microseconds Clock::microseconds()
+{
+    return (boost::posix_time::microsec_clock::universal_time() - timeStart()).total_microseconds();
+}
+
 boost::posix_time::ptime makeTimeStart()
 {
     while(!ticker.dummy());
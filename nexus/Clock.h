@@ -10,10 +10,13 @@ namespace nexus {
 
 typedef int32_t Seconds;
 typedef int64_t Milliseconds;
+typedef int64_t Microseconds;
 
 class Clock {
 public:
     static Milliseconds milliseconds();
+    // Precise time since timeStart, unlike milliseconds() it queries system clock on each call.
+    static Microseconds microseconds();
     static boost::posix_time::ptime posix(Milliseconds time) { return timeStart() + boost::posix_time::milliseconds(time); }
 
     static inline Seconds seconds() { return static_cast<Seconds>(milliseconds() / 1000); }
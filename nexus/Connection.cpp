@@ -10,15 +10,24 @@ mstd::atomic<size_t> activeConnections_;
 mstd::atomic<size_t> allocatedConnections_;
 
 ConnectionBase::ConnectionBase(bool active, size_t readingBuffer, size_t threshold)
-    : asyncOperations_(active), rbuffer_(readingBuffer), rpos_(0), threshold_(threshold),
-      reads_(0), writes_(0), reading_(true)
-{
+    : asyncOperations_(active), lane_(prNormal), rpos_(0), rplain_(0), threshold_(threshold),
+      reads_(0), writes_(0), reading_(true), recorder_(0), captureId_(0),
+      pool_(ConnectionPoolBase::adopt())
+{
+    if(pool_)
+        pool_->acquireBuffer(rbuffer_, readingBuffer);
+    else
+        rbuffer_.resize(readingBuffer);
+    for(size_t i = 0; i != prioritiesCount; ++i)
+        sent_[i] = 0;
     ++allocatedConnections_;
     ++activeConnections_;
 }
 
 ConnectionBase::~ConnectionBase()
 {
+    if(pool_)
+        pool_->releaseBuffer(rbuffer_);
     --activeConnections_;
 }
 
@@ -52,6 +61,17 @@ size_t ConnectionBase::writes()
     return writes_;
 }
 
+size_t ConnectionBase::queued(Priority priority)
+{
+    ConnectionLock lock(this);
+    return pending_[priority].total();
+}
+
+size_t ConnectionBase::sent(Priority priority)
+{
+    return sent_[priority];
+}
+
 int ConnectionBase::rpos()
 {
     return rpos_;
@@ -67,6 +87,12 @@ void ConnectionBase::stopReading()
     reading_ = false;
 }
 
+void ConnectionBase::capture(TrafficRecorder * recorder)
+{
+    recorder_ = recorder;
+    captureId_ = recorder ? recorder->connection() : 0;
+}
+
 bool ConnectionBase::reading()
 {
     return reading_;
@@ -84,7 +110,37 @@ bool ConnectionBase::prepare()
 
 void ConnectionBase::commitWrite(size_t len, ConnectionLock &)
 {
-    pending_.erase(len);
+    pending_[lane_].erase(len);
+    sent_[lane_] += len;
+}
+
+Buffers & ConnectionBase::selectLane(ConnectionLock &)
+{
+    lane_ = nextLane(pending_, lane_);
+    return pending_[lane_];
+}
+
+bool ConnectionBase::pendingEmpty(ConnectionLock &)
+{
+    for(size_t i = 0; i != prioritiesCount; ++i)
+        if(!pending_[i].empty())
+            return false;
+    return true;
+}
+
+size_t ConnectionBase::pendingTotal(ConnectionLock &)
+{
+    size_t result = 0;
+    for(size_t i = 0; i != prioritiesCount; ++i)
+        result += pending_[i].total();
+    return result;
+}
+
+void ConnectionBase::clearPending(ConnectionLock &)
+{
+    for(size_t i = 0; i != prioritiesCount; ++i)
+        pending_[i].clear();
+    lane_ = prNormal;
 }
 
 mlog::Logger & ConnectionBase::getLogger()
@@ -4,13 +4,18 @@
 
 #include <vector>
 
+#include <boost/array.hpp>
+
 #include <boost/asio/ip/tcp.hpp>
 
+#include <boost/mpl/bool.hpp>
+
 #include <boost/thread/mutex.hpp>
 
 #include <boost/system/error_code.hpp>
 
 #include <mstd/atomic.hpp>
+#include <mstd/enum_utils.hpp>
 #include <mstd/threads.hpp>
 
 #include <mlog/Logging.h>
@@ -22,12 +27,23 @@
 #include "AsyncGuard.h"
 #include "AsyncOperations.h"
 #include "Buffers.h"
+#include "Capture.h"
+#include "Cipher.h"
+#include "ConnectionPool.h"
 #include "Handler.h"
+#include "Limiter.h"
 #include "PacketReader.h"
+#include "Stats.h"
+#include "Utils.h"
 
 namespace nexus {
 
-template<class Derived, class Guard, class Lazy, class AsyncData>
+// Send queue lanes, write switches to higher lane at the next frame boundary, buffers of one send() form a frame.
+MSTD_DEFINE_ENUM_EX(Priority, pr, (Normal)(High));
+
+const size_t prioritiesCount = prHigh + 1;
+
+template<class Derived, class Guard, class Lazy, class AsyncData, class Stats, class Limiter, class Cipher>
 class Connection;
 
 class ConnectionLock;
@@ -42,11 +58,16 @@ public:
 
     size_t reads();
     size_t writes();
+    size_t queued(Priority priority);
+    size_t sent(Priority priority);
     int rpos();
     mstd::thread_id lastLocker();
 
     void stopReading();
 
+    // Records traffic of this connection, should be called before connection is started.
+    void capture(TrafficRecorder * recorder);
+
     static size_t activeConnections();
     static size_t allocatedConnections();
 protected:
@@ -56,19 +77,35 @@ protected:
 private:
     static mlog::Logger & getLogger();
     void commitWrite(size_t len, ConnectionLock & lock);
+    Buffers & selectLane(ConnectionLock & lock);
+    bool pendingEmpty(ConnectionLock & lock);
+    size_t pendingTotal(ConnectionLock & lock);
+    void clearPending(ConnectionLock & lock);
+
+    void captureOut(const Buffer & buffer)
+    {
+        if(recorder_)
+            recorder_->record(captureId_, cdOutgoing, buffer.data(), buffer.size());
+    }
 
     AsyncOperations asyncOperations_;
     boost::mutex mutex_;
-    Buffers pending_;
+    boost::array<Buffers, prioritiesCount> pending_;
+    boost::array<mstd::atomic<size_t>, prioritiesCount> sent_;
+    size_t lane_; // lane of write in flight
     std::vector<char> rbuffer_;
     size_t rpos_;
+    size_t rplain_; // rbuffer_ prefix that was decrypted
     size_t threshold_;
     mstd::atomic<size_t> reads_;
     mstd::atomic<size_t> writes_;
     mstd::atomic<bool> reading_;
     mstd::atomic<mstd::thread_id> lastLocker_;
+    TrafficRecorder * recorder_;
+    boost::uint32_t captureId_;
+    ConnectionPoolBase * pool_; // pool that recycles rbuffer_
 
-    template<class, class, class, class>
+    template<class, class, class, class, class, class, class>
     friend class Connection;
     
     friend class ConnectionLock;
@@ -156,10 +193,13 @@ struct NEXUS_DECL NoAsyncData {
     static NoAsyncData null() { return NoAsyncData(); }
 };
 
-template<class Derived, class Guard = NoGuard, class Lazy = NoLazyBuffer, class AD = NoAsyncData>
+template<class Derived, class Guard = NoGuard, class Lazy = NoLazyBuffer, class AD = NoAsyncData, class S = NoStats, class L = NoLimit, class Ci = NoCipher>
 class Connection : public ConnectionBase {
 public:
     typedef AD AsyncData;
+    typedef S Stats;
+    typedef L Limiter;
+    typedef Ci Cipher;
     typedef nexus::Connection<Derived, Guard> base_type;
 
     Connection(bool active, size_t readingBuffer, size_t threshold = 0)
@@ -169,32 +209,39 @@ public:
     Connection(bool active, size_t readingBuffer, size_t threshold = 0, const T & t = T())
         : ConnectionBase(active, readingBuffer, threshold), guard_(t) {}
 
-    void send(const Buffer & buffer)
+    void send(const Buffer & buffer, Priority priority = prNormal)
     {
         if(asyncOperations_.active())
         {
             ConnectionLock lock(this);
 
-            bool wasEmpty = pending_.empty();
+            bool wasEmpty = pendingEmpty(lock);
             commitLazy(lock);
 
-            pending_.push_back(buffer);
+            pending_[priority].push_back(buffer);
+            captureOut(buffer);
+            stats_.sent(1);
+            stats_.queued(pendingTotal(lock));
 
             if(wasEmpty)
                 asyncWrite(lock);
         }
     }
     
-    void send(const std::vector<Buffer> & buffers)
+    void send(const std::vector<Buffer> & buffers, Priority priority = prNormal)
     {
         if(asyncOperations_.active())
         {
             ConnectionLock lock(this);
 
-            bool wasEmpty = pending_.empty();
+            bool wasEmpty = pendingEmpty(lock);
             commitLazy(lock);
 
-            pending_.add(buffers);
+            pending_[priority].add(buffers);
+            for(std::vector<Buffer>::const_iterator i = buffers.begin(), end = buffers.end(); i != end; ++i)
+                captureOut(*i);
+            stats_.sent(buffers.size());
+            stats_.queued(pendingTotal(lock));
 
             if(wasEmpty)
                 asyncWrite(lock);
@@ -207,15 +254,22 @@ public:
         {
             ConnectionLock lock(this);
 
-            if(pending_.empty())
+            stats_.sent(1);
+            if(recorder_)
+                recorder_->record(captureId_, cdOutgoing, data, len);
+            if(pendingEmpty(lock))
             {
-                pending_.push_back(Buffer(data, len));
+                pending_[prNormal].push_back(Buffer(data, len));
+                stats_.queued(pendingTotal(lock));
                 asyncWrite(lock);
-            } else if(!lazy_.feed(data, len))
-            {
-                commitLazy(lock);
+            } else {
                 if(!lazy_.feed(data, len))
-                    pending_.push_back(Buffer(data, len));
+                {
+                    commitLazy(lock);
+                    if(!lazy_.feed(data, len))
+                        pending_[prNormal].push_back(Buffer(data, len));
+                }
+                stats_.queued(pendingTotal(lock));
             }
         }
     }
@@ -238,6 +292,22 @@ public:
         if(asyncOperations_.prepare())
             derived().stream().get_io_service().post(Send<C>(this, c));
     }
+
+    // Derived reports parsed packets from processPackets via stats().packet(code, len).
+    Stats & stats()
+    {
+        return stats_;
+    }
+
+    Limiter & limiter()
+    {
+        return limiter_;
+    }
+
+    Cipher & cipher()
+    {
+        return cipher_;
+    }
 private:
     class AsyncHelper;
 protected:
@@ -245,6 +315,7 @@ protected:
     {
         if(asyncOperations_.shutdown())
         {
+            cancelDeferred(boost::mpl::bool_<Limiter::limited>());
             derived().shutdown();
             return true;
         } else
@@ -313,15 +384,41 @@ private:
 
             ConnectionLock lock(this);
 
-            derived().stream().async_read_some(boost::asio::buffer(&rbuffer_[rpos_], size),
-                                               guard_.wrap(bindRead(baseAsyncData<AsyncData>())));
+            startRead(size, boost::mpl::bool_<Stats::timestamps>());
         }
     }
 
+    void startRead(size_t size, boost::mpl::false_)
+    {
+        derived().stream().async_read_some(boost::asio::buffer(&rbuffer_[rpos_], size),
+                                           guard_.wrap(bindRead(baseAsyncData<AsyncData>())));
+    }
+
+    // Wait for readiness only, data is fetched by recvmsg in completeRead to get control messages.
+    void startRead(size_t size, boost::mpl::true_)
+    {
+        derived().stream().async_read_some(boost::asio::null_buffers(),
+                                           guard_.wrap(bindRead(baseAsyncData<AsyncData>())));
+    }
+
+    size_t completeRead(size_t len, boost::system::error_code & ec, boost::mpl::false_)
+    {
+        return len;
+    }
+
+    size_t completeRead(size_t len, boost::system::error_code & ec, boost::mpl::true_)
+    {
+        Microseconds kernelTime = 0;
+        len = receiveTimestamped(derived().stream(), &rbuffer_[rpos_], rbuffer_.size() - rpos_, kernelTime, ec);
+        if(kernelTime)
+            stats_.arrived(derived().stream().get_io_service(), kernelTime);
+        return len;
+    }
+
     void commitLazy(ConnectionLock &)
     {
         if(!lazy_.empty())
-            pending_.push_back(lazy_.commit());
+            pending_[prNormal].push_back(lazy_.commit());
     }
 
     void handleWrite(const boost::system::error_code & ec, size_t len, AsyncData data)
@@ -336,8 +433,9 @@ private:
         {
             ConnectionLock lock(this);
 
+            stats_.written(len);
             commitWrite(len, lock);
-            if(pending_.mayAdd())
+            if(pending_[prNormal].mayAdd())
                 commitLazy(lock);
             asyncWrite(lock);
         } else {
@@ -349,15 +447,18 @@ private:
 
     void asyncWrite(ConnectionLock & lock)
     {
-        if(!pending_.empty())
+        if(!pendingEmpty(lock))
         {
             if(asyncOperations_.prepare())
             {
                 ++writes_;
+                stats_.writeStarted();
 
-                derived().stream().async_write_some(pending_.ref(), guard_.wrap(bindWrite(baseAsyncData<AsyncData>())));
+                Buffers & lane = selectLane(lock);
+                encryptPending(lane, boost::mpl::bool_<Cipher::enabled>());
+                derived().stream().async_write_some(lane.ref(), guard_.wrap(bindWrite(baseAsyncData<AsyncData>())));
             } else
-                pending_.clear();
+                clearPending(lock);
         } else if(!reading())
             derived().shutdown();
     }
@@ -368,37 +469,112 @@ private:
 
         AsyncGuard guard(this, data);
 
+        if(!ec)
+            len = completeRead(len, ec, boost::mpl::bool_<Stats::timestamps>());
+
         if(!ec)
         {
             rpos_ += len;
+            size_t plain = rplain_;
+            rplain_ += cipher_.decrypt(&rbuffer_[rplain_], rpos_ - rplain_);
+            if(recorder_ && rplain_ != plain)
+                recorder_->record(captureId_, cdIncoming, &rbuffer_[plain], rplain_ - plain);
 
-            PacketReader reader(rbuffer_, rpos_);
+            typename Stats::Mark mark = stats_.received(len);
+            PacketReader reader(rbuffer_, rplain_);
             derived().processPackets(reader);
-            memcpy(&rbuffer_[0], reader.raw(), reader.left());
-            rpos_ = reader.left();
-
+            stats_.processed(mark);
+            size_t consumed = reader.raw() - &rbuffer_[0];
+            memmove(&rbuffer_[0], reader.raw(), rpos_ - consumed);
+            rpos_ -= consumed;
+            rplain_ -= consumed;
+
+            continueRead(len, boost::mpl::bool_<Limiter::limited>());
+        } else if(ec == boost::asio::error::would_block)
             asyncRead();
-        } else {
+        else {
             MLOG_FMESSAGE(Notice, "handleRead(" << ec << ", " << ec.message() << ")");
 
             guard.failed();
         }
     }
 
+    void encryptPending(Buffers & lane, boost::mpl::false_)
+    {
+    }
+
+    // Encrypts in wire order, so buffers are processed only when they are about to be written,
+    // and lane is not switched until sealed buffers are written.
+    void encryptPending(Buffers & lane, boost::mpl::true_)
+    {
+        lane.seal(Encrypt<Cipher>(cipher_));
+    }
+
+    void continueRead(size_t len, boost::mpl::false_)
+    {
+        asyncRead();
+    }
+
+    // Out of budget connection waits on timer, instead of reading and starving others.
+    void continueRead(size_t len, boost::mpl::true_)
+    {
+        limiter_.received(len);
+        Milliseconds delay = limiter_.delay();
+        if(delay && reading() && asyncOperations_.prepare())
+        {
+            limiter_.deferred();
+            ConnectionLock lock(this);
+            boost::asio::deadline_timer & timer = limiter_.timer(derived().stream().get_io_service());
+            timer.expires_from_now(boost::posix_time::milliseconds(delay));
+            timer.async_wait(guard_.wrap(bindDefer(baseAsyncData<AsyncData>())));
+        } else
+            asyncRead();
+    }
+
+    void cancelDeferred(boost::mpl::false_)
+    {
+    }
+
+    // stop could be called from any thread, while io thread arms the timer in continueRead.
+    void cancelDeferred(boost::mpl::true_)
+    {
+        ConnectionLock lock(this);
+        limiter_.cancel();
+    }
+
+    void handleDefer(const boost::system::error_code & ec, AsyncData data)
+    {
+        AsyncGuard guard(this, data);
+
+        if(ec)
+        {
+            if(ec != boost::asio::error::operation_aborted)
+            {
+                MLOG_FMESSAGE(Notice, "handleDefer(" << ec << ", " << ec.message() << ")");
+                guard.failed();
+            }
+            return;
+        }
+        if(reading())
+            asyncRead();
+    }
+
     void doFinish(AsyncData data)
     {
         {
             ConnectionLock lock(this);
 
-            pending_.clear();
+            clearPending(lock);
         }
         rpos_ = 0;
+        rplain_ = 0;
         
         invokeFinish(data);
     }
 
     void doShutdown()
     {
+        cancelDeferred(boost::mpl::bool_<Limiter::limited>());
         derived().shutdown();
     }
 
@@ -450,9 +626,13 @@ private:
 
     NEXUS_DECLARE_HANDLER(Read, Connection, 1, receive, true);
     NEXUS_DECLARE_HANDLER(Write, Connection, 1, send, true);
+    NEXUS_DECLARE_HANDLER(Defer, Connection, 1, wait, true);
 
     Guard guard_;
     Lazy lazy_;
+    Stats stats_;
+    Limiter limiter_;
+    Cipher cipher_;
 
     friend class AsyncHelper;
     friend class SendPBuffer;
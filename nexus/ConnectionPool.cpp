@@ -0,0 +1,239 @@
+#include "pch.h"
+
+#include "ConnectionPool.h"
+
+namespace nexus {
+
+namespace {
+
+const size_t slotAlignment = 0x10;
+
+void nullDeleter(ConnectionPoolBase *)
+{
+}
+
+boost::thread_specific_ptr<ConnectionPoolBase> constructing_(&nullDeleter);
+
+template<class From, class To>
+void transferSlots(From & from, To & to, size_t count)
+{
+    for(; count && !from.empty(); --count)
+    {
+        to.push_back(from.back());
+        from.pop_back();
+    }
+}
+
+template<class From, class To>
+void transferBuffers(From & from, To & to, size_t count)
+{
+    for(; count && !from.empty(); --count)
+    {
+        to.push_back(std::vector<char>());
+        to.back().swap(from.back());
+        from.pop_back();
+    }
+}
+
+}
+
+PoolOccupancy::PoolOccupancy()
+    : live(0), idle(0), buffers(0), slabs(0)
+{
+}
+
+struct ConnectionPoolBase::Cache {
+    Impl * impl;
+    std::vector<void*> slots;
+    std::vector<std::vector<char> > buffers;
+
+    Cache(Impl * i, size_t limit)
+        : impl(i)
+    {
+        slots.reserve(limit + 1);
+        buffers.reserve(limit + 1);
+    }
+
+    ~Cache();
+};
+
+struct ConnectionPoolBase::Impl {
+    size_t objectSize;
+    size_t readingBuffer;
+    size_t slab;
+    size_t threadLimit;
+    size_t batch;
+
+    boost::mutex mutex;
+    std::vector<void*> slots;
+    std::deque<std::vector<char> > buffers;
+    std::vector<char*> slabs;
+
+    mstd::atomic<size_t> live;
+    mstd::atomic<size_t> idle;
+    mstd::atomic<size_t> idleBuffers;
+
+    // Declared last, so caches of current thread are flushed while other members are alive.
+    boost::thread_specific_ptr<Cache> cache;
+
+    Impl(size_t os, size_t rb, size_t s, size_t tl)
+        : objectSize((os + slotAlignment - 1) & ~(slotAlignment - 1)), readingBuffer(rb),
+          slab(std::max<size_t>(s, 1)), threadLimit(std::max<size_t>(tl, 2)), batch(threadLimit / 2),
+          live(0), idle(0), idleBuffers(0)
+    {
+    }
+
+    ~Impl()
+    {
+        cache.reset();
+        for(std::vector<char*>::iterator i = slabs.begin(), end = slabs.end(); i != end; ++i)
+            ::operator delete(*i);
+    }
+
+    Cache & current()
+    {
+        Cache * result = cache.get();
+        if(!result)
+            cache.reset(result = new Cache(this, threadLimit));
+        return *result;
+    }
+
+    void addSlab(size_t count, boost::mutex::scoped_lock &)
+    {
+        char * memory = static_cast<char*>(::operator new(objectSize * count));
+        slabs.push_back(memory);
+        slots.reserve(slots.size() + count);
+        for(size_t i = count; i--;)
+            slots.push_back(memory + i * objectSize);
+        idle += count;
+    }
+
+    void refillSlots(Cache & cache)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if(slots.empty())
+            addSlab(slab, lock);
+        transferSlots(slots, cache.slots, batch);
+    }
+
+    void refillBuffers(Cache & cache)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        transferBuffers(buffers, cache.buffers, batch);
+    }
+
+    void spill(Cache & cache, size_t limit)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if(cache.slots.size() > limit)
+            transferSlots(cache.slots, slots, cache.slots.size() - limit);
+        if(cache.buffers.size() > limit)
+            transferBuffers(cache.buffers, buffers, cache.buffers.size() - limit);
+    }
+};
+
+ConnectionPoolBase::Cache::~Cache()
+{
+    impl->spill(*this, 0);
+}
+
+ConnectionPoolBase::ConnectionPoolBase(size_t objectSize, size_t readingBuffer, size_t slab, size_t threadLimit)
+    : impl_(new Impl(objectSize, readingBuffer, slab, threadLimit))
+{
+}
+
+ConnectionPoolBase::~ConnectionPoolBase()
+{
+    BOOST_ASSERT(!impl_->live);
+}
+
+void * ConnectionPoolBase::allocate()
+{
+    Cache & cache = impl_->current();
+    if(cache.slots.empty())
+        impl_->refillSlots(cache);
+
+    void * result = cache.slots.back();
+    cache.slots.pop_back();
+    --impl_->idle;
+    ++impl_->live;
+    return result;
+}
+
+void ConnectionPoolBase::deallocate(void * object)
+{
+    Cache & cache = impl_->current();
+    cache.slots.push_back(object);
+    ++impl_->idle;
+    --impl_->live;
+    if(cache.slots.size() > impl_->threadLimit)
+        impl_->spill(cache, impl_->batch);
+}
+
+void ConnectionPoolBase::acquireBuffer(std::vector<char> & out, size_t size)
+{
+    Cache & cache = impl_->current();
+    if(cache.buffers.empty())
+        impl_->refillBuffers(cache);
+
+    if(!cache.buffers.empty())
+    {
+        out.swap(cache.buffers.back());
+        cache.buffers.pop_back();
+        --impl_->idleBuffers;
+    }
+    out.resize(size);
+}
+
+void ConnectionPoolBase::releaseBuffer(std::vector<char> & buffer)
+{
+    Cache & cache = impl_->current();
+    cache.buffers.push_back(std::vector<char>());
+    cache.buffers.back().swap(buffer);
+    ++impl_->idleBuffers;
+    if(cache.buffers.size() > impl_->threadLimit)
+        impl_->spill(cache, impl_->batch);
+}
+
+void ConnectionPoolBase::warmup(size_t count)
+{
+    boost::mutex::scoped_lock lock(impl_->mutex);
+    size_t idle = impl_->idle;
+    if(idle < count)
+        impl_->addSlab(count - idle, lock);
+    for(size_t i = impl_->idleBuffers; i < count; ++i)
+    {
+        impl_->buffers.push_back(std::vector<char>(impl_->readingBuffer));
+        ++impl_->idleBuffers;
+    }
+}
+
+PoolOccupancy ConnectionPoolBase::occupancy()
+{
+    PoolOccupancy result;
+    result.live = impl_->live;
+    result.idle = impl_->idle;
+    result.buffers = impl_->idleBuffers;
+    {
+        boost::mutex::scoped_lock lock(impl_->mutex);
+        result.slabs = impl_->slabs.size();
+    }
+    return result;
+}
+
+ConnectionPoolBase::Context::Context(ConnectionPoolBase * pool)
+{
+    constructing_.reset(pool);
+}
+
+ConnectionPoolBase::Context::~Context()
+{
+    constructing_.release();
+}
+
+ConnectionPoolBase * ConnectionPoolBase::adopt()
+{
+    return constructing_.release();
+}
+
+}
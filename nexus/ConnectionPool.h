@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <new>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <boost/preprocessor/arithmetic/inc.hpp>
+#include <boost/preprocessor/repetition/enum_binary_params.hpp>
+#include <boost/preprocessor/repetition/enum_params.hpp>
+#include <boost/preprocessor/repetition/repeat_from_to.hpp>
+
+#endif
+
+#include "Config.h"
+
+#ifndef NEXUS_CONNECTION_POOL_MAX_ARITY
+#define NEXUS_CONNECTION_POOL_MAX_ARITY 5
+#endif
+
+namespace nexus {
+
+struct NEXUS_DECL PoolOccupancy {
+    size_t live; // connections created and not yet destroyed
+    size_t idle; // free object slots
+    size_t buffers; // free read buffers
+    size_t slabs;
+
+    PoolOccupancy();
+};
+
+// Storage and read buffers recycling, shared by all ConnectionPool instantiations.
+// Freed slots and buffers go to the freelist of the calling thread, overflow is moved
+// to the shared list, that also receives warmed objects and remains of exited threads.
+// Pool should outlive threads that use it.
+class NEXUS_DECL ConnectionPoolBase : public boost::noncopyable {
+public:
+    PoolOccupancy occupancy();
+protected:
+    ConnectionPoolBase(size_t objectSize, size_t readingBuffer, size_t slab, size_t threadLimit);
+    ~ConnectionPoolBase();
+
+    void * allocate();
+    void deallocate(void * object);
+    void warmup(size_t count);
+
+    // Connection constructed while context is alive takes its read buffer from pool.
+    class Context : public boost::noncopyable {
+    public:
+        explicit Context(ConnectionPoolBase * pool);
+        ~Context();
+    };
+private:
+    // Returns pool, that constructs current connection, and resets it, so nested connections are not pooled.
+    static ConnectionPoolBase * adopt();
+    void acquireBuffer(std::vector<char> & out, size_t size);
+    void releaseBuffer(std::vector<char> & buffer);
+
+    struct Cache;
+    struct Impl;
+    boost::scoped_ptr<Impl> impl_;
+
+    friend class ConnectionBase;
+};
+
+// Creates Derived connections in slab allocated storage and recycles them with their read buffers.
+// Connection should be destroyed with destroy of the pool that created it, instead of delete.
+template<class Derived>
+class ConnectionPool : public ConnectionPoolBase {
+public:
+    explicit ConnectionPool(size_t readingBuffer, size_t slab = 0x40, size_t threadLimit = 0x100)
+        : ConnectionPoolBase(sizeof(Derived), readingBuffer, slab, threadLimit) {}
+
+    Derived * create()
+    {
+        void * storage = allocate();
+        try {
+            Context context(this);
+            return new (storage) Derived;
+        } catch(...) {
+            deallocate(storage);
+            throw;
+        }
+    }
+
+#define NEXUS_CONNECTION_POOL_CREATE_DEF(z, n, data) \
+    template<BOOST_PP_ENUM_PARAMS(n, class A)> \
+    Derived * create(BOOST_PP_ENUM_BINARY_PARAMS(n, const A, & a)) \
+    { \
+        void * storage = allocate(); \
+        try { \
+            Context context(this); \
+            return new (storage) Derived(BOOST_PP_ENUM_PARAMS(n, a)); \
+        } catch(...) { \
+            deallocate(storage); \
+            throw; \
+        } \
+    } \
+    /**/
+
+    BOOST_PP_REPEAT_FROM_TO(
+        1, BOOST_PP_INC(NEXUS_CONNECTION_POOL_MAX_ARITY),
+        NEXUS_CONNECTION_POOL_CREATE_DEF, ~)
+
+#undef NEXUS_CONNECTION_POOL_CREATE_DEF
+
+    void destroy(Derived * conn)
+    {
+        conn->~Derived();
+        deallocate(conn);
+    }
+
+    // Preallocates storage and read buffers for count connections, usually called at startup.
+    void warm(size_t count)
+    {
+        warmup(count);
+    }
+};
+
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <boost/array.hpp>
+#include <boost/static_assert.hpp>
+
+#include <boost/fusion/include/at_c.hpp>
+#include <boost/fusion/include/for_each.hpp>
+#include <boost/fusion/include/size.hpp>
+#include <boost/fusion/include/zip.hpp>
+
+#include <mstd/changed_set.hpp>
+#include <mstd/cstdint.hpp>
+
+#endif
+
+#include "Config.h"
+
+#include "PacketPacker.h"
+#include "PacketReader.h"
+
+namespace nexus {
+
+// Delta snapshot of fusion adapted struct: bitmask of changed fields followed by those fields only.
+// Fields are packed through GetPacker and read back with PacketReader::read<T>().
+//
+//  BOOST_FUSION_ADAPT_STRUCT(Unit, (boost::uint32_t, hp)(boost::int32_t, x)(boost::int32_t, y))
+//
+//  mstd::changed_set<3> changes;
+//  nexus::diff(sent, unit, changes);
+//  connection.send(nexus::packCSD(pcUnitDelta, nexus::tupleSize(nexus::delta(unit, changes)), nexus::delta(unit, changes)));
+//
+//  nexus::applyDelta(reader, mirror);
+
+template<class Struct>
+struct DeltaMask {
+    static const size_t fields = boost::fusion::result_of::size<Struct>::value;
+    typedef boost::array<boost::uint8_t, (fields + 7) / 8> type;
+};
+
+namespace detail {
+
+    inline bool deltaChanged(const boost::uint8_t * mask, size_t idx)
+    {
+        return (mask[idx >> 3] >> (idx & 7)) & 1;
+    }
+
+    class DeltaSize {
+    public:
+        DeltaSize(const boost::uint8_t * mask, size_t & size)
+            : mask_(mask), size_(&size), idx_(0) {}
+
+        template<class T>
+        void operator()(const T & t) const
+        {
+            if(deltaChanged(mask_, idx_++))
+                *size_ += GetPacker<T>::type::packSize(t);
+        }
+    private:
+        const boost::uint8_t * mask_;
+        size_t * size_;
+        mutable size_t idx_;
+    };
+
+    class DeltaPack {
+    public:
+        DeltaPack(const boost::uint8_t * mask, char *& out)
+            : mask_(mask), out_(&out), idx_(0) {}
+
+        template<class T>
+        void operator()(const T & t) const
+        {
+            if(deltaChanged(mask_, idx_++))
+                GetPacker<T>::type::pack(*out_, t);
+        }
+    private:
+        const boost::uint8_t * mask_;
+        char ** out_;
+        mutable size_t idx_;
+    };
+
+    class DeltaApply {
+    public:
+        DeltaApply(const boost::uint8_t * mask, PacketReader & reader)
+            : mask_(mask), reader_(&reader), idx_(0) {}
+
+        template<class T>
+        void operator()(T & t) const
+        {
+            if(deltaChanged(mask_, idx_++))
+                t = reader_->read<T>();
+        }
+    private:
+        const boost::uint8_t * mask_;
+        PacketReader * reader_;
+        mutable size_t idx_;
+    };
+
+    template<size_t N>
+    class DeltaDiff {
+    public:
+        explicit DeltaDiff(mstd::changed_set<N> & changes)
+            : changes_(&changes), idx_(0) {}
+
+        template<class Pair>
+        void operator()(const Pair & pair) const
+        {
+            if(boost::fusion::at_c<0>(pair) != boost::fusion::at_c<1>(pair))
+                changes_->changed(idx_);
+            ++idx_;
+        }
+    private:
+        mstd::changed_set<N> * changes_;
+        mutable size_t idx_;
+    };
+
+}
+
+template<class Struct, size_t N>
+class DeltaRef {
+public:
+    typedef DeltaRef packer;
+    typedef typename DeltaMask<Struct>::type Mask;
+
+    BOOST_STATIC_ASSERT(DeltaMask<Struct>::fields <= N);
+
+    DeltaRef(const Struct & value, const mstd::changed_set<N> & changes)
+        : value_(&value)
+    {
+        mask_.assign(0);
+        for(typename mstd::changed_set<N>::const_iterator i = changes.begin(), end = changes.end(); i != end; ++i)
+        {
+            BOOST_ASSERT(*i < DeltaMask<Struct>::fields);
+            mask_[*i >> 3] |= 1 << (*i & 7);
+        }
+    }
+
+    size_t packSize() const
+    {
+        size_t result = mask_.size();
+        boost::fusion::for_each(*value_, detail::DeltaSize(mask_.data(), result));
+        return result;
+    }
+
+    void pack(char *& out) const
+    {
+        memcpy(out, mask_.data(), mask_.size());
+        out += mask_.size();
+        boost::fusion::for_each(*value_, detail::DeltaPack(mask_.data(), out));
+    }
+private:
+    const Struct * value_;
+    Mask mask_;
+};
+
+template<class Struct, size_t N>
+DeltaRef<Struct, N> delta(const Struct & value, const mstd::changed_set<N> & changes)
+{
+    return DeltaRef<Struct, N>(value, changes);
+}
+
+// Marks fields of value that differ from baseline.
+template<class Struct, size_t N>
+void diff(const Struct & baseline, const Struct & value, mstd::changed_set<N> & changes)
+{
+    boost::fusion::for_each(boost::fusion::zip(baseline, value), detail::DeltaDiff<N>(changes));
+}
+
+template<class Struct>
+void applyDelta(PacketReader & reader, Struct & mirror)
+{
+    typename DeltaMask<Struct>::type mask;
+    reader.readArray(mask);
+    boost::fusion::for_each(mirror, detail::DeltaApply(mask.data(), reader));
+}
+
+}
@@ -26,23 +26,209 @@ IoThreadPool::~IoThreadPool()
 
 namespace {
 
+typedef std::vector<int> Cpus;
+
+#if defined(__linux__)
+Cpus availableCpus()
+{
+    Cpus result;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set))
+    {
+        MLOG_MESSAGE(Error, "sched_getaffinity failed: " << errno);
+        return result;
+    }
+    for(int i = 0; i != CPU_SETSIZE; ++i)
+        if(CPU_ISSET(i, &set))
+            result.push_back(i);
+    return result;
+}
+
+bool setAffinity(pid_t tid, const Cpus & cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(Cpus::const_iterator i = cpus.begin(), end = cpus.end(); i != end; ++i)
+        CPU_SET(*i, &set);
+    if(sched_setaffinity(tid, sizeof(set), &set))
+    {
+        MLOG_MESSAGE(Error, "sched_setaffinity(" << tid << ") failed: " << errno);
+        return false;
+    }
+    return true;
+}
+
+bool setThreadAffinity(pthread_t thread, const Cpus & cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(Cpus::const_iterator i = cpus.begin(), end = cpus.end(); i != end; ++i)
+        CPU_SET(*i, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if(err)
+    {
+        MLOG_MESSAGE(Error, "pthread_setaffinity_np failed: " << err);
+        return false;
+    }
+    return true;
+}
+
+// Parses list of form "0-3,8,10-11".
+Cpus readCpuList(const char * path)
+{
+    Cpus result;
+    std::ifstream inp(path);
+    std::string line;
+    if(!std::getline(inp, line))
+        return result;
+    for(const char * p = line.c_str(); *p; )
+    {
+        char * next;
+        long first = strtol(p, &next, 10);
+        if(next == p)
+            break;
+        long last = first;
+        if(*next == '-')
+            last = strtol(next + 1, &next, 10);
+        for(long i = first; i <= last; ++i)
+            result.push_back(static_cast<int>(i));
+        p = *next == ',' ? next + 1 : next;
+    }
+    return result;
+}
+
+// Cpus allowed by cgroup quota, zero when unlimited.
+double cgroupQuota()
+{
+    std::ifstream v2("/sys/fs/cgroup/cpu.max");
+    if(v2)
+    {
+        std::string quota;
+        long period = 0;
+        v2 >> quota >> period;
+        return quota != "max" && period > 0 ? strtod(quota.c_str(), 0) / period : 0;
+    }
+
+    std::ifstream quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us"), period("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    long q = -1, p = 0;
+    quota >> q;
+    period >> p;
+    return q > 0 && p > 0 ? static_cast<double>(q) / p : 0;
+}
+
+// Available cpus of node that has most of them.
+Cpus largestNode(const Cpus & available, int & node)
+{
+    Cpus result;
+    node = -1;
+    for(int i = 0; ; ++i)
+    {
+        char path[0x40];
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", i);
+        if(access(path, R_OK))
+            break;
+        Cpus cpus = readCpuList(path), common;
+        std::set_intersection(cpus.begin(), cpus.end(), available.begin(), available.end(), std::back_inserter(common));
+        if(common.size() > result.size())
+        {
+            result.swap(common);
+            node = i;
+        }
+    }
+    return node == -1 ? available : result;
+}
+
+#endif
+
+class CpusFormatter {
+public:
+    explicit CpusFormatter(const Cpus & cpus)
+        : cpus_(cpus) {}
+
+    friend std::ostream & operator<<(std::ostream & out, const CpusFormatter & formatter)
+    {
+        const Cpus & cpus = formatter.cpus_;
+        if(cpus.empty())
+            return out << "none";
+        for(size_t i = 0; i != cpus.size(); )
+        {
+            size_t j = i + 1;
+            while(j != cpus.size() && cpus[j] == cpus[j - 1] + 1)
+                ++j;
+            if(i)
+                out << ',';
+            out << cpus[i];
+            if(j - i > 1)
+                out << '-' << cpus[j - 1];
+            i = j;
+        }
+        return out;
+    }
+private:
+    const Cpus & cpus_;
+};
+
 class Runner {
 public:
-    explicit Runner(boost::asio::io_service & service)
-        : service_(service) {}
+    explicit Runner(boost::asio::io_service & service, const Cpus & cpus = Cpus())
+        : service_(service), cpus_(cpus) {}
 
     void operator()() const
     {
         MLOG_MESSAGE(Notice, "runner");
+#if defined(__linux__)
+        if(!cpus_.empty())
+            setAffinity(0, cpus_);
+#endif
         service_.run();
         MLOG_MESSAGE(Notice, "runner, done");
     }
 private:
     boost::asio::io_service & service_;
+    Cpus cpus_;
 };
 
 }
 
+ThreadTopology parseTopology(const std::string & input)
+{
+    ThreadTopology result;
+    for(const char * p = input.c_str(); *p; )
+    {
+        const char * end = strchr(p, ',');
+        if(!end)
+            end = p + strlen(p);
+        const char * eq = std::find(p, end, '=');
+        std::string name(p, eq);
+        p = *end ? end + 1 : end;
+        unsigned long value = 1;
+        if(eq != end)
+        {
+            std::string text(eq + 1, end);
+            char * parsed;
+            errno = 0;
+            value = strtoul(text.c_str(), &parsed, 10);
+            if(text.empty() || !isdigit(static_cast<unsigned char>(text[0])) || *parsed || errno)
+            {
+                MLOG_MESSAGE(Error, "invalid topology option value: " << name << "=" << text);
+                continue;
+            }
+        }
+        if(name == "threads")
+            result.threads = value;
+        else if(name == "reserved")
+            result.reserved = value;
+        else if(name == "pin")
+            result.pin = value != 0;
+        else if(name == "node")
+            result.singleNode = value != 0;
+        else
+            MLOG_MESSAGE(Warning, "unknown topology option: " << name);
+    }
+    return result;
+}
+
 void IoThreadPool::start(size_t count)
 {
     MLOG_MESSAGE(Notice, "start");
@@ -53,6 +239,66 @@ void IoThreadPool::start(size_t count)
         impl_->threads.push_back(new boost::thread(tracer(logger, Runner(impl_->ioService))));
 }
 
+void IoThreadPool::start(const ThreadTopology & topology)
+{
+#if defined(__linux__)
+    Cpus cpus = availableCpus();
+    int node = -1;
+    if(topology.singleNode)
+        cpus = largestNode(cpus, node);
+
+    size_t limit = cpus.size();
+    double quota = cgroupQuota();
+    if(quota > 0)
+        limit = std::min(limit, std::max<size_t>(static_cast<size_t>(ceil(quota)), 1));
+
+    Cpus reserved, io;
+    if(topology.reserved && limit > topology.reserved && cpus.size() > topology.reserved)
+    {
+        reserved.assign(cpus.begin(), cpus.begin() + topology.reserved);
+        io.assign(cpus.begin() + topology.reserved, cpus.end());
+        limit -= topology.reserved;
+    } else
+        io = cpus;
+
+    size_t count = topology.threads ? topology.threads : std::max<size_t>(limit, 1);
+    if(quota > 0 && count > limit)
+    {
+        MLOG_MESSAGE(Warning, "threads: " << count << " exceed cpu quota: " << quota << ", using: " << limit);
+        count = limit;
+    }
+
+    MLOG_MESSAGE(Notice, "start, threads: " << count << ", io cpus: " << CpusFormatter(io) << ", reserved cpus: " << CpusFormatter(reserved) <<
+                         ", pin: " << topology.pin << ", node: " << node << ", quota: " << quota);
+
+    // Starting thread and logging thread are moved, other threads created by application keep their affinity.
+    if(!reserved.empty())
+    {
+        setAffinity(0, reserved);
+        boost::thread::native_handle_type logThread;
+        if(mlog::Manager::instance().outputThread(logThread))
+            setThreadAffinity(logThread, reserved);
+    }
+
+    impl_->threads.reserve(count);
+    for(size_t i = 0; i != count; ++i)
+    {
+        Cpus affinity;
+        if(topology.pin && !io.empty())
+            affinity.push_back(io[i % io.size()]);
+        else if(!reserved.empty() || node != -1)
+            affinity = io;
+        impl_->threads.push_back(new boost::thread(tracer(logger, Runner(impl_->ioService, affinity))));
+    }
+#else
+    size_t count = topology.threads ? topology.threads : std::max<size_t>(boost::thread::hardware_concurrency(), 1);
+
+    MLOG_MESSAGE(Notice, "start, threads: " << count << ", affinity is not supported");
+
+    start(count);
+#endif
+}
+
 void IoThreadPool::stop()
 {
     MLOG_MESSAGE(Notice, "stop");
@@ -6,6 +6,21 @@ namespace boost { namespace asio {
 
 namespace nexus {
 
+// Placement of io threads. Thread that starts pool, i.e. console, and realtime logging thread
+// are moved to reserved cpus, threads created later by starting thread inherit it.
+struct ThreadTopology {
+    size_t threads; // zero to size from cpus available to process, capped by cgroup cpu quota
+    size_t reserved; // cpus that io threads do not use, starting and logging threads are moved there
+    bool pin; // pin every io thread to single cpu, otherwise io threads share io cpus
+    bool singleNode; // use only cpus of numa node that has most of available cpus
+
+    ThreadTopology()
+        : threads(0), reserved(0), pin(false), singleNode(false) {}
+};
+
+// Parses comma separated options, i.e. "threads=8,reserved=1,pin=1,node=0", malformed options are logged and skipped.
+ThreadTopology parseTopology(const std::string & input);
+
 class IoThreadPool {
 public:
     IoThreadPool();
@@ -14,6 +29,7 @@ public:
     boost::asio::io_service & ioService();
 
     void start(size_t count);
+    void start(const ThreadTopology & topology);
     void stop();
 private:
     struct Impl;
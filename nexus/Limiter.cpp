@@ -0,0 +1,69 @@
+#include "pch.h"
+
+#include "Limiter.h"
+
+namespace nexus {
+
+TokenBucket::TokenBucket(size_t bytesPerSecond, size_t packetsPerSecond)
+    : deferrals_(0)
+{
+    configure(bytesPerSecond, packetsPerSecond);
+}
+
+TokenBucket::~TokenBucket()
+{
+}
+
+void TokenBucket::configure(size_t bytesPerSecond, size_t packetsPerSecond)
+{
+    bytesRate_ = bytesPerSecond;
+    packetsRate_ = packetsPerSecond;
+    bytes_ = static_cast<Milliseconds>(bytesRate_) * 1000;
+    packets_ = static_cast<Milliseconds>(packetsRate_) * 1000;
+    last_ = Clock::milliseconds();
+}
+
+Milliseconds TokenBucket::refill(Milliseconds tokens, size_t rate, Milliseconds elapsed)
+{
+    if(!rate)
+        return 0;
+    Milliseconds burst = static_cast<Milliseconds>(rate) * 1000;
+    return std::min(tokens + static_cast<Milliseconds>(rate) * elapsed, burst);
+}
+
+Milliseconds TokenBucket::wait(Milliseconds tokens, size_t rate)
+{
+    if(!rate || tokens >= 0)
+        return 0;
+    return (-tokens + rate - 1) / rate;
+}
+
+Milliseconds TokenBucket::delay()
+{
+    Milliseconds now = Clock::milliseconds();
+    Milliseconds elapsed = now - last_;
+    last_ = now;
+
+    bytes_ = refill(bytes_, bytesRate_, elapsed);
+    packets_ = refill(packets_, packetsRate_, elapsed);
+
+    return std::max(wait(bytes_, bytesRate_), wait(packets_, packetsRate_));
+}
+
+boost::asio::deadline_timer & TokenBucket::timer(boost::asio::io_service & ioService)
+{
+    if(!timer_)
+        timer_.reset(new boost::asio::deadline_timer(ioService));
+    return *timer_;
+}
+
+void TokenBucket::cancel()
+{
+    if(timer_)
+    {
+        boost::system::error_code ec;
+        timer_->cancel(ec);
+    }
+}
+
+}
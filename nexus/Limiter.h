@@ -0,0 +1,83 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+
+#endif
+
+#include "Config.h"
+
+#include "Clock.h"
+
+namespace nexus {
+
+// Inbound limiter policies for Connection, NoLimit compiles to nothing.
+class NoLimit {
+public:
+    static const bool limited = false;
+
+    void packet() {}
+    void cancel() {}
+};
+
+// Token buckets for received bytes and packets, zero rate means unlimited.
+// Buckets go into debt, since amount is known only after read, and connection
+// defers next read until debt is repaid. Frames decoded by PacketDispatcher are charged to
+// packet bucket, Derived that decodes frames itself reports them via limiter().packet().
+class NEXUS_DECL TokenBucket : public boost::noncopyable {
+public:
+    static const bool limited = true;
+
+    explicit TokenBucket(size_t bytesPerSecond = 0, size_t packetsPerSecond = 0);
+    ~TokenBucket();
+
+    void configure(size_t bytesPerSecond, size_t packetsPerSecond);
+
+    void received(size_t bytes)
+    {
+        bytes_ -= static_cast<Milliseconds>(bytes) * 1000;
+    }
+
+    void packet()
+    {
+        packets_ -= 1000;
+    }
+
+    // Milliseconds to wait before next read.
+    Milliseconds delay();
+
+    boost::asio::deadline_timer & timer(boost::asio::io_service & ioService);
+
+    // Aborts deferred read, so closed connection is not kept alive by the timer.
+    // Timer is not thread safe, so it is armed and cancelled under connection lock.
+    void cancel();
+
+    void deferred()
+    {
+        ++deferrals_;
+    }
+
+    size_t deferrals() const
+    {
+        return deferrals_;
+    }
+private:
+    static Milliseconds refill(Milliseconds tokens, size_t rate, Milliseconds elapsed);
+    static Milliseconds wait(Milliseconds tokens, size_t rate);
+
+    size_t bytesRate_;
+    size_t packetsRate_;
+    // Tokens are scaled by 1000, so refill is exact for millisecond steps.
+    Milliseconds bytes_;
+    Milliseconds packets_;
+    Milliseconds last_;
+    size_t deferrals_;
+    boost::scoped_ptr<boost::asio::deadline_timer> timer_;
+};
+
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <boost/array.hpp>
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <boost/mpl/for_each.hpp>
+
+#include <mstd/cstdint.hpp>
+#include <mstd/singleton.hpp>
+
+#endif
+
+#include "Config.h"
+
+#include "Packet.h"
+#include "PacketReader.h"
+
+namespace nexus {
+
+// Largest length that packCSD could encode, 15 + 15 bits.
+const size_t maxFrameSize = 0x3fffffff;
+
+// Extracts next packCSD frame from reader.
+// Returns false and leaves reader at frame start when frame is not complete yet.
+inline bool decodeFrame(PacketReader & reader, PacketCode & code, PacketReader & body)
+{
+    if(reader.left() < 3)
+        return false;
+
+    reader.mark();
+    code = reader.read<PacketCode>();
+    size_t len = reader.read<boost::uint16_t>();
+    if(len & 0x8000)
+    {
+        if(reader.left() < 2)
+        {
+            reader.revert();
+            return false;
+        }
+        len = (static_cast<size_t>(reader.read<boost::uint16_t>()) << 15) | (len & 0x7fff);
+    }
+    if(len > reader.left())
+    {
+        reader.revert();
+        return false;
+    }
+
+    body = reader.subreader(0, len);
+    reader.skip(len);
+    return true;
+}
+
+// Maps packet code to handler method, frames with body size outside of [minSize, maxSize] are rejected.
+template<class Derived, PacketCode c, void (Derived::*m)(PacketReader &), size_t minSize = 0, size_t maxSize = maxFrameSize>
+struct PacketHandler {
+};
+
+// Dispatches packCSD frames to Derived methods through a dense table indexed by PacketCode.
+// Handlers is mpl sequence of PacketHandler, table is built on first use per Derived/Handlers pair,
+// each dispatcher looks it up once when constructed. Every decoded frame is charged to derived.limiter().
+//
+//  typedef boost::mpl::vector<
+//      nexus::PacketHandler<Node, pcPing, &Node::ping, 0, 0>,
+//      nexus::PacketHandler<Node, pcData, &Node::data, 4>
+//  > Handlers;
+//
+//  void Node::processPackets(nexus::PacketReader & reader)
+//  {
+//      dispatcher_(*this, reader);
+//  }
+template<class Derived, class Handlers>
+class PacketDispatcher : public boost::noncopyable {
+public:
+    typedef void (Derived::*Method)(PacketReader &);
+
+    PacketDispatcher()
+        : table_(Table::instance().entries), unknown_(0), rejected_(0)
+    {
+        unknownCodes_.assign(0);
+    }
+
+    void operator()(Derived & derived, PacketReader & reader)
+    {
+        PacketCode code;
+        PacketReader body;
+        while(decodeFrame(reader, code, body))
+        {
+            derived.limiter().packet();
+            const Entry & entry = table_[code];
+            if(!entry.method)
+            {
+                ++unknown_;
+                ++unknownCodes_[code];
+            } else if(body.left() < entry.minSize || body.left() > entry.maxSize)
+                ++rejected_;
+            else
+                (derived.*entry.method)(body);
+        }
+    }
+
+    size_t unknown() const
+    {
+        return unknown_;
+    }
+
+    size_t unknown(PacketCode code) const
+    {
+        return unknownCodes_[code];
+    }
+
+    size_t rejected() const
+    {
+        return rejected_;
+    }
+private:
+    struct Entry {
+        Method method;
+        size_t minSize;
+        size_t maxSize;
+    };
+
+    class Table : public mstd::singleton<Table> {
+    public:
+        boost::array<Entry, 0x100> entries;
+    private:
+        class Filler {
+        public:
+            explicit Filler(boost::array<Entry, 0x100> & entries)
+                : entries_(&entries) {}
+
+            template<PacketCode c, void (Derived::*m)(PacketReader &), size_t minSize, size_t maxSize>
+            void operator()(PacketHandler<Derived, c, m, minSize, maxSize>) const
+            {
+                Entry & entry = (*entries_)[c];
+                BOOST_ASSERT(!entry.method);
+                entry.method = m;
+                entry.minSize = minSize;
+                entry.maxSize = maxSize;
+            }
+        private:
+            boost::array<Entry, 0x100> * entries_;
+        };
+
+        Table()
+        {
+            for(size_t i = 0; i != entries.size(); ++i)
+            {
+                entries[i].method = 0;
+                entries[i].minSize = 0;
+                entries[i].maxSize = 0;
+            }
+            boost::mpl::for_each<Handlers>(Filler(entries));
+        }
+
+        MSTD_SINGLETON_DECLARATION(Table);
+    };
+
+    const boost::array<Entry, 0x100> & table_;
+    size_t unknown_;
+    boost::array<size_t, 0x100> unknownCodes_;
+    size_t rejected_;
+};
+
+}
@@ -12,8 +12,10 @@
 
 #include <boost/preprocessor/repetition/repeat_from_to.hpp>
 
+#include <boost/type_traits/is_integral.hpp>
 #include <boost/type_traits/is_pod.hpp>
 #include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/is_signed.hpp>
 
 #include <boost/range/iterator_range.hpp>
 
@@ -192,6 +194,61 @@ struct CollectionPacker {
     }
 };
 
+template<class Packer>
+struct VarintCollectionPacker {
+    template<class Collection>
+    static size_t packSize(const Collection & col)
+    {
+        size_t result = varintSize(col.size());
+        for(typename Collection::const_iterator i = col.begin(), end = col.end(); i != end; ++i)
+            result += Packer::packSize(*i);
+        return result;
+    }
+
+    template<class Collection>
+    static void pack(char *& out, const Collection & col)
+    {
+        writeVarint(out, col.size());
+        for(typename Collection::const_iterator i = col.begin(), end = col.end(); i != end; ++i)
+            Packer::pack(out, *i);
+    }
+};
+
+// Integer as LEB128 varint, read by PacketReader::readVarint/readZigzag.
+class Varint {
+public:
+    typedef Varint packer;
+
+    explicit Varint(boost::uint64_t value)
+        : value_(value) {}
+
+    size_t packSize() const
+    {
+        return varintSize(value_);
+    }
+
+    void pack(char *& out) const
+    {
+        writeVarint(out, value_);
+    }
+private:
+    boost::uint64_t value_;
+};
+
+template<class T>
+Varint varint(T t)
+{
+    BOOST_STATIC_ASSERT((boost::is_integral<T>::value && !boost::is_signed<T>::value));
+    return Varint(t);
+}
+
+template<class T>
+Varint zigzag(T t)
+{
+    BOOST_STATIC_ASSERT((boost::is_integral<T>::value && boost::is_signed<T>::value));
+    return Varint(zigzagEncode(t));
+}
+
 template<class T>
 class SinglePacker {
 public:
@@ -388,6 +445,80 @@ struct GetPacker<boost::reference_wrapper<T> > {
     typedef ReferencePacker<packer> type;
 };
 
+// Collection with varint count, elements are packed as usual.
+template<class T>
+class VarintCollectionRef {
+public:
+    typedef VarintCollectionRef packer;
+
+    explicit VarintCollectionRef(const T & t)
+        : value_(&t) {}
+
+    size_t packSize() const
+    {
+        return VarintCollectionPacker<typename GetPacker<T>::packer>::packSize(*value_);
+    }
+
+    void pack(char *& out) const
+    {
+        VarintCollectionPacker<typename GetPacker<T>::packer>::pack(out, *value_);
+    }
+private:
+    const T * value_;
+};
+
+template<class T>
+VarintCollectionRef<T> varintCollection(const T & t)
+{
+    return VarintCollectionRef<T>(t);
+}
+
+template<class Value, bool sign = boost::is_signed<Value>::value>
+struct VarintValue {
+    static boost::uint64_t encode(Value value) { return value; }
+};
+
+template<class Value>
+struct VarintValue<Value, true> {
+    static boost::uint64_t encode(Value value) { return zigzagEncode(value); }
+};
+
+// Integer collection with varint count and elements, signed elements are zigzag encoded.
+// Read by PacketReader::readVarints.
+template<class T>
+class VarintsRef {
+public:
+    typedef VarintsRef packer;
+    typedef VarintValue<typename T::value_type> Value;
+
+    explicit VarintsRef(const T & t)
+        : value_(&t) {}
+
+    size_t packSize() const
+    {
+        size_t result = varintSize(value_->size());
+        for(typename T::const_iterator i = value_->begin(), end = value_->end(); i != end; ++i)
+            result += varintSize(Value::encode(*i));
+        return result;
+    }
+
+    void pack(char *& out) const
+    {
+        writeVarint(out, value_->size());
+        for(typename T::const_iterator i = value_->begin(), end = value_->end(); i != end; ++i)
+            writeVarint(out, Value::encode(*i));
+    }
+private:
+    const T * value_;
+};
+
+template<class T>
+VarintsRef<T> varints(const T & t)
+{
+    BOOST_STATIC_ASSERT((boost::is_integral<typename T::value_type>::value));
+    return VarintsRef<T>(t);
+}
+
 template<class T>
 size_t SinglePacker<T>::packSize() const
 {
@@ -6,6 +6,22 @@
 
 namespace nexus {
 
+boost::uint64_t PacketReader::readLongVarint()
+{
+    boost::uint64_t result = 0;
+    // 64 bit value takes at most 10 bytes.
+    for(size_t shift = 0; shift < 70; shift += 7)
+    {
+        if(pos_ == end_)
+            throw InvalidVarintException();
+        boost::uint8_t byte = static_cast<boost::uint8_t>(*pos_++);
+        result |= static_cast<boost::uint64_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return result;
+    }
+    throw InvalidVarintException();
+}
+
 std::string decompress(const Buffer & input)
 {
     return decompress(input.data(), input.size());
@@ -19,6 +19,7 @@
 
 #include <boost/type_traits/is_pod.hpp>
 #include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/is_signed.hpp>
 
 #include <boost/utility/enable_if.hpp>
 
@@ -62,6 +63,16 @@ public:
     ~InvalidStringException() throw () {}
 };
 
+class NEXUS_DECL InvalidVarintException : public std::exception {
+public:
+    const char * what() const throw()
+    {
+        return "invalid varint exception";
+    }
+    
+    ~InvalidVarintException() throw () {}
+};
+
 class NEXUS_DECL PacketReader {
 public:
     explicit PacketReader()
@@ -168,6 +179,55 @@ public:
             result.push_back(read<T>());
     }
 
+    boost::uint64_t readVarint()
+    {
+        if(pos_ != end_)
+        {
+            boost::uint8_t first = static_cast<boost::uint8_t>(*pos_);
+            if(!(first & 0x80))
+            {
+                ++pos_;
+                return first;
+            }
+        }
+        return readLongVarint();
+    }
+
+    template<class T>
+    T readVarint()
+    {
+        BOOST_STATIC_ASSERT(!boost::is_signed<T>::value);
+        return static_cast<T>(readVarint());
+    }
+
+    template<class T>
+    T readZigzag()
+    {
+        BOOST_STATIC_ASSERT(boost::is_signed<T>::value);
+        boost::uint64_t value = readVarint();
+        return static_cast<T>(static_cast<boost::int64_t>(value >> 1) ^ -static_cast<boost::int64_t>(value & 1));
+    }
+
+    // Reads collection packed with varintCollection.
+    template<class T>
+    void readVarintCollection(std::vector<T> & result)
+    {
+        size_t len = readVarintLength();
+        result.reserve(len);
+        while(result.size() != len)
+            result.push_back(read<T>());
+    }
+
+    // Reads collection packed with varints.
+    template<class T>
+    void readVarints(std::vector<T> & result)
+    {
+        size_t len = readVarintLength();
+        result.resize(len);
+        for(typename std::vector<T>::iterator i = result.begin(), end = result.end(); i != end; ++i)
+            *i = decodeVarint<T>(readVarintWord());
+    }
+
     template<class T>
     typename boost::enable_if<detail::IsVector<T>, T>::type
     read()
@@ -260,6 +320,67 @@ public:
         return marked_;
     }
 private:
+    boost::uint64_t readLongVarint();
+
+    // Element count of varint collection, every element takes at least one byte.
+    size_t readVarintLength()
+    {
+        boost::uint64_t len = readVarint();
+        if(len > left())
+            throw InvalidVarintException();
+        return static_cast<size_t>(len);
+    }
+
+    // Decodes varints up to 8 bytes from a single word without per byte branches.
+    boost::uint64_t readVarintWord()
+    {
+        if(end_ - pos_ < 8)
+            return readVarint();
+
+        boost::uint64_t word;
+        memcpy(&word, pos_, sizeof(word));
+        boost::uint64_t stops = ~word & 0x8080808080808080ULL;
+        if(!stops)
+            return readLongVarint();
+
+        size_t len = (lowestBit(stops) >> 3) + 1;
+        pos_ += len;
+        if(len != 8)
+            word &= (static_cast<boost::uint64_t>(1) << (len * 8)) - 1;
+        word &= 0x7f7f7f7f7f7f7f7fULL;
+        word = (word & 0x007f007f007f007fULL) | ((word & 0x7f007f007f007f00ULL) >> 1);
+        word = (word & 0x00003fff00003fffULL) | ((word & 0x3fff00003fff0000ULL) >> 2);
+        word = (word & 0x000000000fffffffULL) | ((word & 0x0fffffff00000000ULL) >> 4);
+        return word;
+    }
+
+    // value has only high bits of bytes set.
+    static size_t lowestBit(boost::uint64_t value)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctzll(value);
+#else
+        size_t result = 7;
+        while(!((value >> result) & 1))
+            result += 8;
+        return result;
+#endif
+    }
+
+    template<class T>
+    static typename boost::disable_if<boost::is_signed<T>, T>::type
+    decodeVarint(boost::uint64_t value)
+    {
+        return static_cast<T>(value);
+    }
+
+    template<class T>
+    static typename boost::enable_if<boost::is_signed<T>, T>::type
+    decodeVarint(boost::uint64_t value)
+    {
+        return static_cast<T>(static_cast<boost::int64_t>(value >> 1) ^ -static_cast<boost::int64_t>(value & 1));
+    }
+
     const char * pos_;
     const char * end_;
     const char * marked_;
@@ -51,6 +51,39 @@ inline void writeLenString(char *& out, const std::string & str)
     writeLenString(out, str.c_str(), str.length());
 }
 
+inline size_t varintSize(boost::uint64_t value)
+{
+    size_t result = 1;
+    while(value >= 0x80)
+    {
+        value >>= 7;
+        ++result;
+    }
+    return result;
+}
+
+// LEB128, 7 bits per byte starting from lowest, high bit means that more bytes follow.
+inline void writeVarint(char *& p, boost::uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        *p++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = static_cast<char>(value);
+}
+
+// Maps signed values to unsigned ones, so that small absolute values get short varints.
+inline boost::uint64_t zigzagEncode(boost::int64_t value)
+{
+    return (static_cast<boost::uint64_t>(value) << 1) ^ static_cast<boost::uint64_t>(value >> 63);
+}
+
+inline boost::int64_t zigzagDecode(boost::uint64_t value)
+{
+    return static_cast<boost::int64_t>(value >> 1) ^ -static_cast<boost::int64_t>(value & 1);
+}
+
 inline void writePacked(char *& p, boost::uint32_t size)
 {
     if(size <= 0x7fff)
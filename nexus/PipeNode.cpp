@@ -2,6 +2,7 @@
 
 #ifdef BOOST_WINDOWS
 
+#include "PacketDispatcher.h"
 #include "PacketReader.h"
 #include "PipeNode.h"
 
@@ -132,23 +133,13 @@ void PipeNode::shutdown()
 
 void PipeNode::processPackets(PacketReader & reader)
 {
-    while(reader.left() >= 3)
+    PacketCode code;
+    PacketReader body;
+    while(decodeFrame(reader, code, body))
     {
-        reader.mark();
-        PacketCode code = reader.read<PacketCode>();
-        boost::uint32_t len = reader.read<boost::uint16_t>();
-        if(len > 0x7fff)
-        {
-            if(reader.left() >= 2)
-                len = (reader.read<uint16_t>() << 15) | (len & 0x7fff);
-        }
-        if(len > reader.left())
-        {
-            reader.revert();
-            break;
-        }
-        listener_(code, reader.subreader(0, len));
-        reader.skip(len);
+        stats().packet(code, body.left());
+        limiter().packet();
+        listener_(code, body);
     }
 }
 
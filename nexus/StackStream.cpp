@@ -5,55 +5,41 @@
 namespace nexus {
 
 StackStream::StackStream(char * begin, size_t size)
-    : begin_(begin), pos_(begin), end_(begin + size) {}
+    : BasicStackStream<StackStream>(begin, size) {}
 
-void StackStream::put(const char * str)
-{
-    ptrdiff_t n = std::find(str, str + (end_ - pos_) + 1, 0) - str;
-    checkOverflow(n);
-    memcpy(pos_, str, n);
-    pos_ += n;
-}
-
-void StackStream::put(const std::string & str)
-{
-    ptrdiff_t n = str.length();
-    checkOverflow(n);
-    memcpy(pos_, str.c_str(), n);
-    pos_ += n;
-}
-
-void StackStream::writeCString(const std::string & str)
+Buffer StackStream::buffer() const
 {
-    ptrdiff_t n = str.length() + 1;
-    checkOverflow(n);
-    memcpy(pos_, str.c_str(), n);
-    pos_ += n;
+    return Buffer(begin_, pos_);
 }
 
-void StackStream::put(char ch)
+void StackStream::overflow(size_t required)
 {
-    checkOverflow(1);
-    *pos_ = ch;
-    ++pos_;
+    BOOST_THROW_EXCEPTION(StackStreamException() << mstd::error_message("stack buffer overflow") << ErrorPosition(pos_ - begin_) << ErrorSize(end_ - begin_) << ErrorRequired(required));
 }
 
-void StackStream::write(const char * data, size_t n)
-{
-    checkOverflow(n);
-    memcpy(pos_, data, n);
-    pos_ += n;
-}
+GrowingStackStream::GrowingStackStream(char * begin, size_t size)
+    : BasicStackStream<GrowingStackStream>(begin, size) {}
 
-Buffer StackStream::buffer() const
+Buffer GrowingStackStream::buffer() const
 {
-    return Buffer(begin_, pos_);
+    if(spill_)
+    {
+        Buffer result(spill_);
+        result.resize(pos_ - begin_);
+        return result;
+    } else
+        return Buffer(begin_, pos_);
 }
 
-void StackStream::checkOverflow(size_t required)
+void GrowingStackStream::overflow(size_t required)
 {
-    if(static_cast<size_t>(end_ - pos_) < required)
-        BOOST_THROW_EXCEPTION(StackStreamException() << mstd::error_message("stack buffer overflow") << ErrorPosition(pos_ - begin_) << ErrorSize(end_ - begin_) << ErrorRequired(required));
+    size_t used = pos_ - begin_;
+    Buffer spill(std::max<size_t>((end_ - begin_) * 2, used + required));
+    memcpy(spill.data(), begin_, used);
+    spill_.swap(spill);
+    begin_ = spill_.data();
+    pos_ = begin_ + used;
+    end_ = begin_ + spill_.capacity();
 }
 
 }
@@ -22,10 +22,10 @@ typedef boost::error_info<SizeTag, size_t> ErrorSize;
 class RequiredTag;
 typedef boost::error_info<RequiredTag, size_t> ErrorRequired;
 
-class NEXUS_DECL StackStream {
+// Writing part of stack streams, Derived handles overflow and tells whether it could grow.
+template<class Derived>
+class BasicStackStream {
 public:
-    explicit StackStream(char * begin, size_t size);
-
     void revert()
     {
         pos_ = begin_;
@@ -62,12 +62,36 @@ public:
         write(mstd::pointer_cast<const char*>(&buf[0]), buf.size());
     }
 
-    void writeCString(const std::string & str);
-    void write(const char * str, size_t len);
+    void writeCString(const std::string & str)
+    {
+        write(str.c_str(), str.length() + 1);
+    }
+
+    void write(const char * str, size_t len)
+    {
+        checkOverflow(len);
+        memcpy(pos_, str, len);
+        pos_ += len;
+    }
 
-    void put(const char * str);
-    void put(const std::string & str);
-    void put(char ch);
+    void put(const char * str)
+    {
+        // Fixed stream does not scan past its end, string that does not fit is rejected anyway.
+        size_t n = Derived::growable ? strlen(str) : static_cast<size_t>(std::find(str, str + (end_ - pos_) + 1, 0) - str);
+        write(str, n);
+    }
+
+    void put(const std::string & str)
+    {
+        write(str.c_str(), str.length());
+    }
+
+    void put(char ch)
+    {
+        checkOverflow(1);
+        *pos_ = ch;
+        ++pos_;
+    }
 
     template<class T>
     typename boost::enable_if<boost::is_integral<T>, void>::type
@@ -88,13 +112,49 @@ public:
     char * begin() const { return begin_; }
     char * pos() const { return pos_; }
     char * end() const { return end_; }
-    Buffer buffer() const;
-private:
-    void checkOverflow(size_t required);
+protected:
+    BasicStackStream(char * begin, size_t size)
+        : begin_(begin), pos_(begin), end_(begin + size) {}
+
+    void checkOverflow(size_t required)
+    {
+        if(static_cast<size_t>(end_ - pos_) < required)
+            static_cast<Derived*>(this)->overflow(required);
+    }
 
     char * begin_;
     char * pos_;
     char * end_;
 };
 
+class NEXUS_DECL StackStream : public BasicStackStream<StackStream> {
+public:
+    static const bool growable = false;
+
+    explicit StackStream(char * begin, size_t size);
+
+    Buffer buffer() const;
+private:
+    void overflow(size_t required);
+
+    friend class BasicStackStream<StackStream>;
+};
+
+// Starts in caller provided region, and on overflow moves to pooled buffer instead of throwing.
+class NEXUS_DECL GrowingStackStream : public BasicStackStream<GrowingStackStream> {
+public:
+    static const bool growable = true;
+
+    explicit GrowingStackStream(char * begin, size_t size);
+
+    // Shares pooled chunk when stream spilled, so stream should not be written after it.
+    Buffer buffer() const;
+private:
+    void overflow(size_t required);
+
+    Buffer spill_;
+
+    friend class BasicStackStream<GrowingStackStream>;
+};
+
 }
@@ -0,0 +1,185 @@
+#include "pch.h"
+
+#include "Stats.h"
+
+namespace nexus {
+
+namespace {
+
+const size_t shardsCount = 0x10;
+
+void nullDeleter(TrafficStats::Shard *)
+{
+}
+
+void nullServiceDeleter(TrafficStats::ServiceShard *)
+{
+}
+
+}
+
+TrafficSnapshot::TrafficSnapshot()
+    : bytesIn(0), bytesOut(0), packetsIn(0), packetsOut(0), writeStall(0), readStall(0)
+{
+    codes.assign(0);
+    wireLatency.assign(0);
+}
+
+TrafficStats::Shard::Shard()
+    : bytesIn(0), bytesOut(0), packetsIn(0), packetsOut(0), writeStall(0), readStall(0)
+{
+    for(size_t i = 0; i != codes.size(); ++i)
+        codes[i] = 0;
+}
+
+TrafficStats::ServiceShard::ServiceShard(const boost::asio::io_service * s)
+    : service(s)
+{
+    for(size_t i = 0; i != wireLatency.size(); ++i)
+        wireLatency[i] = 0;
+}
+
+struct TrafficStats::Impl {
+    boost::array<Shard, shardsCount> shards;
+    boost::thread_specific_ptr<Shard> current;
+    mstd::atomic<size_t> next;
+
+    boost::mutex servicesMutex;
+    boost::ptr_vector<ServiceShard> services; // never shrinks, so threads keep pointers to its elements
+    boost::thread_specific_ptr<ServiceShard> currentService;
+
+    Impl()
+        : current(&nullDeleter), next(0), currentService(&nullServiceDeleter) {}
+};
+
+TrafficStats::TrafficStats()
+    : impl_(new Impl)
+{
+}
+
+TrafficStats::~TrafficStats()
+{
+}
+
+TrafficStats::Shard & TrafficStats::shard()
+{
+    Shard * result = impl_->current.get();
+    if(!result)
+    {
+        result = &impl_->shards[impl_->next++ % shardsCount];
+        impl_->current.reset(result);
+    }
+    return *result;
+}
+
+TrafficStats::ServiceShard & TrafficStats::serviceShard(const boost::asio::io_service & service)
+{
+    ServiceShard * result = impl_->currentService.get();
+    if(!result || result->service != &service)
+    {
+        boost::mutex::scoped_lock lock(impl_->servicesMutex);
+        result = 0;
+        for(boost::ptr_vector<ServiceShard>::iterator i = impl_->services.begin(), end = impl_->services.end(); i != end; ++i)
+            if(i->service == &service)
+            {
+                result = &*i;
+                break;
+            }
+        if(!result)
+        {
+            impl_->services.push_back(new ServiceShard(&service));
+            result = &impl_->services.back();
+        }
+        impl_->currentService.reset(result);
+    }
+    return *result;
+}
+
+TrafficSnapshot TrafficStats::snapshot()
+{
+    TrafficSnapshot result;
+    for(size_t i = 0; i != shardsCount; ++i)
+    {
+        const Shard & shard = impl_->shards[i];
+        result.bytesIn += shard.bytesIn;
+        result.bytesOut += shard.bytesOut;
+        result.packetsIn += shard.packetsIn;
+        result.packetsOut += shard.packetsOut;
+        result.writeStall += shard.writeStall;
+        result.readStall += shard.readStall;
+        for(size_t j = 0; j != result.codes.size(); ++j)
+            result.codes[j] += shard.codes[j];
+    }
+    std::vector<ServiceLatency> services = wireLatencies();
+    for(std::vector<ServiceLatency>::const_iterator i = services.begin(), end = services.end(); i != end; ++i)
+        for(size_t j = 0; j != result.wireLatency.size(); ++j)
+            result.wireLatency[j] += i->wireLatency[j];
+    return result;
+}
+
+std::vector<ServiceLatency> TrafficStats::wireLatencies()
+{
+    boost::mutex::scoped_lock lock(impl_->servicesMutex);
+    std::vector<ServiceLatency> result(impl_->services.size());
+    for(size_t i = 0; i != result.size(); ++i)
+    {
+        const ServiceShard & shard = impl_->services[i];
+        result[i].service = shard.service;
+        for(size_t j = 0; j != result[i].wireLatency.size(); ++j)
+            result[i].wireLatency[j] = shard.wireLatency[j];
+    }
+    return result;
+}
+
+void TrafficStats::status(std::ostream & out)
+{
+    out << snapshot();
+}
+
+std::ostream & operator<<(std::ostream & out, const TrafficSnapshot & snapshot)
+{
+    out << "in: " << snapshot.bytesIn << "b/" << snapshot.packetsIn << "p, out: " << snapshot.bytesOut << "b/" << snapshot.packetsOut
+        << "p, write stall: " << snapshot.writeStall << "us, read stall: " << snapshot.readStall << "us";
+    for(size_t i = 0; i != snapshot.codes.size(); ++i)
+        if(snapshot.codes[i])
+            out << ", #" << i << ": " << snapshot.codes[i];
+    for(size_t i = 0; i != snapshot.wireLatency.size(); ++i)
+        if(snapshot.wireLatency[i])
+            out << ", <" << (static_cast<size_t>(1) << i) << "us: " << snapshot.wireLatency[i];
+    return out;
+}
+
+ConnectionStats::ConnectionStats()
+    : bytesIn_(0), bytesOut_(0), packetsIn_(0), packetsOut_(0), queuedHighWater_(0),
+      writeStall_(0), readStall_(0), maxReadStall_(0), writeStart_(0)
+{
+    codes_.assign(0);
+}
+
+ConnectionSnapshot ConnectionStats::snapshot() const
+{
+    ConnectionSnapshot result;
+    result.bytesIn = bytesIn_;
+    result.bytesOut = bytesOut_;
+    result.packetsIn = packetsIn_;
+    result.packetsOut = packetsOut_;
+    result.queuedHighWater = queuedHighWater_;
+    result.writeStall = writeStall_;
+    result.readStall = readStall_;
+    result.maxReadStall = maxReadStall_;
+    result.codes = codes_;
+    return result;
+}
+
+std::ostream & operator<<(std::ostream & out, const ConnectionSnapshot & snapshot)
+{
+    out << "in: " << snapshot.bytesIn << "b/" << snapshot.packetsIn << "p, out: " << snapshot.bytesOut << "b/" << snapshot.packetsOut
+        << "p, queued max: " << snapshot.queuedHighWater << "b, write stall: " << snapshot.writeStall
+        << "us, read stall: " << snapshot.readStall << "us, max: " << snapshot.maxReadStall << "us";
+    for(size_t i = 0; i != snapshot.codes.size(); ++i)
+        if(snapshot.codes[i])
+            out << ", #" << i << ": " << snapshot.codes[i];
+    return out;
+}
+
+}
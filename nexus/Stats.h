@@ -0,0 +1,232 @@
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <iosfwd>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/singleton.hpp>
+
+#endif
+
+#include "Config.h"
+
+#include "Clock.h"
+#include "Packet.h"
+
+namespace boost { namespace asio {
+    class io_service;
+} }
+
+namespace nexus {
+
+// Bucket i counts latencies in [2^(i-1), 2^i) microseconds, bucket 0 holds zero and clock skew.
+typedef boost::array<size_t, 0x20> LatencyHistogram;
+
+inline size_t latencyBucket(Microseconds latency)
+{
+    size_t result = 0;
+    while(latency > 0 && result != LatencyHistogram::static_size - 1)
+    {
+        latency >>= 1;
+        ++result;
+    }
+    return result;
+}
+
+struct NEXUS_DECL TrafficSnapshot {
+    size_t bytesIn;
+    size_t bytesOut;
+    size_t packetsIn;
+    size_t packetsOut;
+    size_t writeStall; // microseconds spent with a write in flight
+    size_t readStall; // microseconds spent in processPackets
+    boost::array<size_t, 0x100> codes;
+    LatencyHistogram wireLatency; // kernel receive to processPackets
+
+    TrafficSnapshot();
+};
+
+// Wire latency of connections served by io_service, to spot services whose handlers delay reads.
+struct ServiceLatency {
+    const boost::asio::io_service * service;
+    LatencyHistogram wireLatency;
+};
+
+NEXUS_DECL std::ostream & operator<<(std::ostream & out, const TrafficSnapshot & snapshot);
+
+// Process wide traffic counters, sharded per thread so that updates do not bounce cache lines.
+// snapshot() sums shards while traffic goes on, so the result is consistent only per counter.
+class NEXUS_DECL TrafficStats : public mstd::singleton<TrafficStats> {
+public:
+    struct Shard;
+    struct ServiceShard;
+
+    Shard & shard();
+    // Histogram of io_service that thread runs, threads usually stay with one service, so it is cached per thread.
+    ServiceShard & serviceShard(const boost::asio::io_service & service);
+
+    TrafficSnapshot snapshot();
+    // Wire latency histogram of each io_service that received timestamped data.
+    std::vector<ServiceLatency> wireLatencies();
+    void status(std::ostream & out);
+
+    ~TrafficStats();
+private:
+    TrafficStats();
+
+    struct Impl;
+    boost::scoped_ptr<Impl> impl_;
+
+    MSTD_SINGLETON_DECLARATION(TrafficStats);
+};
+
+struct TrafficStats::Shard {
+    mstd::atomic<size_t> bytesIn;
+    mstd::atomic<size_t> bytesOut;
+    mstd::atomic<size_t> packetsIn;
+    mstd::atomic<size_t> packetsOut;
+    mstd::atomic<size_t> writeStall;
+    mstd::atomic<size_t> readStall;
+    boost::array<mstd::atomic<size_t>, 0x100> codes;
+
+    Shard();
+};
+
+struct TrafficStats::ServiceShard {
+    const boost::asio::io_service * service;
+    boost::array<mstd::atomic<size_t>, LatencyHistogram::static_size> wireLatency;
+
+    explicit ServiceShard(const boost::asio::io_service * s);
+};
+
+struct ConnectionSnapshot {
+    size_t bytesIn;
+    size_t bytesOut;
+    size_t packetsIn;
+    size_t packetsOut;
+    size_t queuedHighWater;
+    size_t writeStall;
+    size_t readStall;
+    size_t maxReadStall;
+    boost::array<size_t, 0x100> codes;
+};
+
+// Stats policies for Connection, NoStats compiles to nothing.
+class NoStats {
+public:
+    struct Mark {};
+
+    static const bool timestamps = false;
+
+    void sent(size_t) {}
+    void queued(size_t) {}
+    void writeStarted() {}
+    void written(size_t) {}
+    Mark received(size_t) { return Mark(); }
+    void processed(Mark) {}
+    void packet(PacketCode, size_t) {}
+};
+
+class NEXUS_DECL ConnectionStats {
+public:
+    typedef Microseconds Mark;
+
+    static const bool timestamps = false;
+
+    ConnectionStats();
+
+    void sent(size_t packets)
+    {
+        packetsOut_ += packets;
+        TrafficStats::Shard & shard = shard_();
+        shard.packetsOut += packets;
+    }
+
+    void queued(size_t total)
+    {
+        if(total > queuedHighWater_)
+            queuedHighWater_ = total;
+    }
+
+    void writeStarted()
+    {
+        writeStart_ = Clock::microseconds();
+    }
+
+    void written(size_t bytes)
+    {
+        size_t stall = static_cast<size_t>(Clock::microseconds() - writeStart_);
+        bytesOut_ += bytes;
+        writeStall_ += stall;
+        TrafficStats::Shard & shard = shard_();
+        shard.bytesOut += bytes;
+        shard.writeStall += stall;
+    }
+
+    Mark received(size_t bytes)
+    {
+        bytesIn_ += bytes;
+        shard_().bytesIn += bytes;
+        return Clock::microseconds();
+    }
+
+    void processed(Mark mark)
+    {
+        size_t stall = static_cast<size_t>(Clock::microseconds() - mark);
+        readStall_ += stall;
+        if(stall > maxReadStall_)
+            maxReadStall_ = stall;
+        shard_().readStall += stall;
+    }
+
+    // kernelTime is the SO_TIMESTAMPING receive time, comparable with Clock::microseconds().
+    void arrived(const boost::asio::io_service & service, Microseconds kernelTime)
+    {
+        ++TrafficStats::instance().serviceShard(service).wireLatency[latencyBucket(Clock::microseconds() - kernelTime)];
+    }
+
+    void packet(PacketCode code, size_t)
+    {
+        ++packetsIn_;
+        ++codes_[code];
+        TrafficStats::Shard & shard = shard_();
+        ++shard.packetsIn;
+        ++shard.codes[code];
+    }
+
+    ConnectionSnapshot snapshot() const;
+private:
+    static TrafficStats::Shard & shard_()
+    {
+        return TrafficStats::instance().shard();
+    }
+
+    mstd::atomic<size_t> bytesIn_;
+    mstd::atomic<size_t> bytesOut_;
+    mstd::atomic<size_t> packetsIn_;
+    mstd::atomic<size_t> packetsOut_;
+    size_t queuedHighWater_; // updated under connection lock
+    mstd::atomic<size_t> writeStall_;
+    mstd::atomic<size_t> readStall_;
+    size_t maxReadStall_; // updated by reading side only
+    boost::array<size_t, 0x100> codes_; // updated by reading side only
+    Microseconds writeStart_;
+};
+
+// Same as ConnectionStats, but reads go through recvmsg to obtain kernel receive timestamps.
+// Socket should be set up with timestamps enabled, see setupSocket.
+class TimestampingStats : public ConnectionStats {
+public:
+    static const bool timestamps = true;
+};
+
+NEXUS_DECL std::ostream & operator<<(std::ostream & out, const ConnectionSnapshot & snapshot);
+
+}
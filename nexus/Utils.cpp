@@ -31,7 +31,7 @@ void listen(boost::asio::ip::tcp::acceptor & acceptor, const boost::asio::ip::tc
     }
 }
 
-void setupSocket(boost::asio::ip::tcp::socket & socket, int sendBufferSize, int recvBufferSize)
+void setupSocket(boost::asio::ip::tcp::socket & socket, int sendBufferSize, int recvBufferSize, bool timestamps)
 {
     boost::system::error_code ec;
 
@@ -66,6 +66,64 @@ void setupSocket(boost::asio::ip::tcp::socket & socket, int sendBufferSize, int
 
         MLOG_MESSAGE(Info, "new socket options, send: " << sends.value() << ", recv: " << recvs.value());
     }
+
+    if(timestamps)
+    {
+#if defined(__linux__)
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if(setsockopt(socket.native_handle(), SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)))
+            MLOG_MESSAGE(Error, "set SO_TIMESTAMPING failed: " << errno);
+#else
+        MLOG_MESSAGE(Warning, "receive timestamps are not supported");
+#endif
+    }
+}
+
+size_t receiveTimestamped(boost::asio::ip::tcp::socket & socket, char * buffer, size_t size,
+                          Microseconds & kernelTime, boost::system::error_code & ec)
+{
+#if defined(__linux__)
+    iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(timespec) * 3)];
+        cmsghdr align;
+    } control;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t result = recvmsg(socket.native_handle(), &msg, MSG_DONTWAIT);
+    if(result < 0)
+    {
+        ec = boost::system::error_code(errno, boost::asio::error::get_system_category());
+        return 0;
+    } else if(!result && size)
+    {
+        ec = boost::asio::error::eof;
+        return 0;
+    }
+
+    for(cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+        {
+            // First timespec is software timestamp, others are legacy and hardware ones.
+            const timespec * ts = mstd::pointer_cast<const timespec*>(CMSG_DATA(cmsg));
+            if(ts->tv_sec || ts->tv_nsec)
+                kernelTime = static_cast<Microseconds>(ts->tv_sec) * 1000000 + ts->tv_nsec / 1000;
+        }
+
+    ec = boost::system::error_code();
+    return result;
+#else
+    return socket.read_some(boost::asio::buffer(buffer, size), ec);
+#endif
 }
 
 }
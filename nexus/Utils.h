@@ -4,14 +4,22 @@
 
 #include <boost/asio/ip/tcp.hpp>
 
+#include <boost/system/error_code.hpp>
+
 #endif
 
 #include "Config.h"
 
+#include "Clock.h"
+
 namespace nexus {
 
 NEXUS_DECL void listen(boost::asio::ip::tcp::acceptor & acceptor, const boost::asio::ip::tcp::endpoint & ep);
 NEXUS_DECL void listen(boost::asio::ip::tcp::acceptor & acceptor, unsigned short port);
-NEXUS_DECL void setupSocket(boost::asio::ip::tcp::socket & socket, int sendBufferSize, int recvBufferSize);
+// timestamps enables SO_TIMESTAMPING software receive timestamps, where supported.
+NEXUS_DECL void setupSocket(boost::asio::ip::tcp::socket & socket, int sendBufferSize, int recvBufferSize, bool timestamps = false);
+// Non blocking read via recvmsg, kernelTime is set to receive timestamp or left intact when there is none.
+NEXUS_DECL size_t receiveTimestamped(boost::asio::ip::tcp::socket & socket, char * buffer, size_t size,
+                                     Microseconds & kernelTime, boost::system::error_code & ec);
 
 }
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <vector>
+
+#include <boost/array.hpp>
+
+#include <mcrypt/Crypt.h>
+
+#include <nexus/Buffers.h>
+#include <nexus/Cipher.h>
+
+// Checks that sealed buffers reach the wire in keystream order, while high priority frames
+// and multi buffer frames are interleaved with partial writes, as Connection::asyncWrite does it.
+// Also checks that CryptCipher talks to mcrypt::Crypt peer in both directions.
+namespace {
+
+const size_t normal = 0;
+const size_t high = 1;
+const size_t lanesCount = 2;
+
+typedef boost::array<nexus::Buffers, lanesCount> Lanes;
+
+// Frame is id byte, two byte length and length bytes equal to id.
+nexus::Buffer makeFrame(unsigned char id, size_t len)
+{
+    nexus::Buffer result(3 + len);
+    char * p = result.data();
+    p[0] = static_cast<char>(id);
+    p[1] = static_cast<char>(len & 0xff);
+    p[2] = static_cast<char>(len >> 8);
+    memset(p + 3, id, len);
+    return result;
+}
+
+std::vector<nexus::Buffer> splitFrame(unsigned char id, size_t len)
+{
+    nexus::Buffer frame = makeFrame(id, len);
+    std::vector<nexus::Buffer> result;
+    result.push_back(nexus::Buffer(frame.data(), 3));
+    result.push_back(nexus::Buffer(frame.data() + 3, len));
+    return result;
+}
+
+bool empty(const Lanes & lanes)
+{
+    for(size_t i = 0; i != lanesCount; ++i)
+        if(!lanes[i].empty())
+            return false;
+    return true;
+}
+
+// Writes random prefix of what async_write_some would get.
+void writeSome(Lanes & lanes, size_t & lane, nexus::ChainCipher & cipher, std::vector<char> & wire)
+{
+    lane = nexus::nextLane(lanes, lane);
+    nexus::Buffers & buffers = lanes[lane];
+    buffers.seal(nexus::Encrypt<nexus::ChainCipher>(cipher));
+    std::vector<char> gathered;
+    nexus::BuffersRef ref = buffers.ref();
+    for(nexus::BuffersRef::const_iterator i = ref.begin(), end = ref.end(); i != end; ++i)
+    {
+        boost::asio::const_buffer buffer = *i;
+        const char * data = boost::asio::buffer_cast<const char*>(buffer);
+        gathered.insert(gathered.end(), data, data + boost::asio::buffer_size(buffer));
+    }
+    size_t len = 1 + rand() % gathered.size();
+    wire.insert(wire.end(), gathered.begin(), gathered.begin() + len);
+    buffers.erase(len);
+}
+
+// packCSD frame with body filled by code, long header is used for bodies of 0x8000 and more.
+std::vector<char> makePacket(unsigned char code, size_t len)
+{
+    std::vector<char> result(1, static_cast<char>(code));
+    boost::uint16_t low = static_cast<boost::uint16_t>(len < 0x8000 ? len : 0x8000 | (len & 0x7fff));
+    result.insert(result.end(), reinterpret_cast<const char*>(&low), reinterpret_cast<const char*>(&low) + 2);
+    if(len >= 0x8000)
+    {
+        boost::uint16_t high = static_cast<boost::uint16_t>(len >> 15);
+        result.insert(result.end(), reinterpret_cast<const char*>(&high), reinterpret_cast<const char*>(&high) + 2);
+    }
+    result.resize(result.size() + len, static_cast<char>(code));
+    return result;
+}
+
+std::vector<std::vector<char> > makePackets()
+{
+    std::vector<std::vector<char> > result;
+    for(size_t i = 0; i != 200; ++i)
+        result.push_back(makePacket(static_cast<unsigned char>(i), i % 50 == 49 ? 0x8000 + rand() % 0x100 : rand() % 0x100));
+    return result;
+}
+
+unsigned char * bytes(std::vector<char> & data, size_t offset = 0)
+{
+    return reinterpret_cast<unsigned char*>(&data[0] + offset);
+}
+
+// Sealed frames, some of them split into header and body buffers and some packed several to buffer,
+// as committed LazyBuffer does, are decrypted by Crypt frame by frame.
+bool cryptOutgoing(const std::vector<unsigned char> & key)
+{
+    nexus::CryptCipher cipher;
+    cipher.init(key, key);
+    std::vector<std::vector<char> > packets = makePackets();
+    nexus::Buffers buffers;
+    for(size_t i = 0; i != packets.size(); ++i)
+    {
+        const std::vector<char> & packet = packets[i];
+        if(i % 4 == 2 && i + 2 < packets.size())
+        {
+            std::vector<char> packed(packet);
+            for(size_t j = 1; j != 3; ++j)
+                packed.insert(packed.end(), packets[i + j].begin(), packets[i + j].end());
+            buffers.push_back(nexus::Buffer(&packed[0], packed.size()));
+            i += 2;
+        } else if(i % 2)
+        {
+            size_t header = packet.size() - 3 >= 0x8000 ? 5 : 3;
+            std::vector<nexus::Buffer> parts;
+            parts.push_back(nexus::Buffer(&packet[0], header));
+            if(packet.size() != header)
+                parts.push_back(nexus::Buffer(&packet[header], packet.size() - header));
+            buffers.add(parts);
+        } else
+            buffers.push_back(nexus::Buffer(&packet[0], packet.size()));
+    }
+
+    std::vector<char> wire;
+    while(!buffers.empty())
+    {
+        buffers.seal(nexus::Encrypt<nexus::CryptCipher>(cipher));
+        nexus::BuffersRef ref = buffers.ref();
+        size_t len = 0;
+        for(nexus::BuffersRef::const_iterator i = ref.begin(), end = ref.end(); i != end; ++i)
+        {
+            const char * data = boost::asio::buffer_cast<const char*>(*i);
+            wire.insert(wire.end(), data, data + boost::asio::buffer_size(*i));
+            len += boost::asio::buffer_size(*i);
+        }
+        buffers.erase(len);
+    }
+
+    mcrypt::Crypt crypt(key);
+    size_t pos = 0;
+    for(size_t i = 0; i != packets.size(); ++i)
+    {
+        if(wire.size() - pos < packets[i].size())
+            return false;
+        crypt.decrypt(bytes(wire, pos), bytes(wire, pos + packets[i].size()));
+        if(memcmp(&wire[pos], &packets[i][0], packets[i].size()))
+        {
+            std::cerr << "outgoing frame " << i << " does not match Crypt" << std::endl;
+            return false;
+        }
+        pos += packets[i].size();
+    }
+    return pos == wire.size();
+}
+
+// Frames encrypted by Crypt arrive in random reads, as Connection::handleRead passes them to decrypt.
+bool cryptIncoming(const std::vector<unsigned char> & key)
+{
+    std::vector<std::vector<char> > packets = makePackets();
+    mcrypt::Crypt crypt(key);
+    std::vector<char> wire, expected;
+    for(size_t i = 0; i != packets.size(); ++i)
+    {
+        std::vector<char> packet = packets[i];
+        expected.insert(expected.end(), packet.begin(), packet.end());
+        crypt.encrypt(bytes(packet), bytes(packet, packet.size()));
+        wire.insert(wire.end(), packet.begin(), packet.end());
+    }
+
+    nexus::CryptCipher cipher;
+    cipher.init(key, key);
+    std::vector<char> buffer, received;
+    size_t plain = 0;
+    for(size_t pos = 0; pos != wire.size();)
+    {
+        size_t len = std::min<size_t>(1 + rand() % 0x200, wire.size() - pos);
+        buffer.insert(buffer.end(), wire.begin() + pos, wire.begin() + pos + len);
+        pos += len;
+        plain += cipher.decrypt(&buffer[plain], buffer.size() - plain);
+        received.insert(received.end(), buffer.begin(), buffer.begin() + plain);
+        buffer.erase(buffer.begin(), buffer.begin() + plain);
+        plain = 0;
+    }
+    if(!buffer.empty() || received != expected)
+    {
+        std::cerr << "incoming frames do not match Crypt" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main()
+{
+    srand(1);
+
+    std::vector<unsigned char> key;
+    for(size_t i = 0; i != 0x10; ++i)
+        key.push_back(static_cast<unsigned char>(rand()));
+    nexus::ChainCipher sender, receiver;
+    sender.init(key, key);
+    receiver.init(key, key);
+
+    Lanes lanes;
+    size_t lane = 0;
+    std::vector<char> wire;
+    size_t frames = 0;
+    unsigned char id = 1;
+
+    nexus::Buffer shared = makeFrame(0xff, 0x20);
+    std::vector<char> original(shared.data(), shared.data() + shared.size());
+
+    for(size_t round = 0; round != 1000; ++round)
+    {
+        for(size_t i = 0; i != 6; ++i, ++frames, id = id == 0xfe ? 1 : id + 1)
+        {
+            if(i % 3 == 2)
+                lanes[normal].add(splitFrame(id, rand() % 0x40));
+            else
+                lanes[normal].push_back(makeFrame(id, rand() % 0x40));
+        }
+        lanes[normal].push_back(shared);
+        ++frames;
+
+        writeSome(lanes, lane, sender, wire);
+        // priority frame arrives while normal lane is partially written
+        lanes[high].push_back(makeFrame(id, rand() % 0x40));
+        ++frames;
+        id = id == 0xfe ? 1 : id + 1;
+
+        while(!empty(lanes))
+            writeSome(lanes, lane, sender, wire);
+    }
+
+    bool ok = std::equal(original.begin(), original.end(), shared.data());
+    if(!ok)
+        std::cerr << "shared buffer was encrypted in place" << std::endl;
+
+    receiver.decrypt(&wire[0], wire.size());
+    size_t parsed = 0;
+    for(size_t pos = 0; ok && pos != wire.size(); ++parsed)
+    {
+        if(wire.size() - pos < 3)
+        {
+            std::cerr << "truncated frame header at " << pos << std::endl;
+            ok = false;
+            break;
+        }
+        unsigned char frameId = static_cast<unsigned char>(wire[pos]);
+        size_t len = static_cast<unsigned char>(wire[pos + 1]) | (static_cast<size_t>(static_cast<unsigned char>(wire[pos + 2])) << 8);
+        pos += 3;
+        if(wire.size() - pos < len)
+        {
+            std::cerr << "truncated frame body at " << pos << std::endl;
+            ok = false;
+            break;
+        }
+        for(size_t i = 0; i != len; ++i)
+            if(static_cast<unsigned char>(wire[pos + i]) != frameId)
+            {
+                std::cerr << "corrupt frame " << static_cast<int>(frameId) << " at " << pos << std::endl;
+                ok = false;
+                break;
+            }
+        pos += len;
+    }
+    ok = ok && parsed == frames;
+    bool crypt = cryptOutgoing(key) && cryptIncoming(key);
+
+    std::cout << "{\"benchmark\":\"nexus.cipherorder\",\"frames\":" << frames
+              << ",\"parsed\":" << parsed
+              << ",\"bytes\":" << wire.size()
+              << ",\"crypt\":" << (crypt ? "true" : "false")
+              << ",\"ok\":" << (ok && crypt ? "true" : "false")
+              << '}' << std::endl;
+
+    return ok && crypt ? 0 : 1;
+}
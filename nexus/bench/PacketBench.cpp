@@ -0,0 +1,328 @@
+#include <stdlib.h>
+
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/performance_timer.hpp>
+
+#include <nexus/PacketPacker.h>
+#include <nexus/PacketReader.h>
+
+namespace {
+
+mstd::atomic<size_t> heapBytes(0);
+mstd::atomic<size_t> heapBlocks(0);
+
+}
+
+void * operator new(size_t size)
+{
+    heapBytes += size;
+    ++heapBlocks;
+    void * result = malloc(size ? size : 1);
+    if(!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void operator delete(void * p) throw()
+{
+    free(p);
+}
+
+void * operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete[](void * p) throw()
+{
+    operator delete(p);
+}
+
+namespace {
+
+const nexus::PacketCode pcScalar = 0x10;
+const nexus::PacketCode pcStrings = 0x11;
+const nexus::PacketCode pcNested = 0x12;
+
+#pragma pack(push)
+#pragma pack(1)
+struct Item {
+    boost::uint32_t id;
+    boost::uint16_t kind;
+    boost::int32_t x;
+    boost::int32_t y;
+};
+#pragma pack(pop)
+
+struct ScalarMessage {
+    boost::uint32_t id;
+    boost::uint32_t owner;
+    boost::uint16_t kind;
+    boost::uint8_t flags;
+    boost::int64_t time;
+    boost::int32_t x;
+    boost::int32_t y;
+    boost::int32_t z;
+    boost::uint16_t hp;
+    boost::uint16_t mp;
+    boost::uint8_t level;
+    double speed;
+
+    nexus::Buffer pack() const
+    {
+        size_t len = nexus::tupleSize(id, owner, kind, flags, time, x, y, z, hp, mp, level, speed);
+        return nexus::packCSD(pcScalar, len, id, owner, kind, flags, time, x, y, z, hp, mp, level, speed);
+    }
+
+    void unpack(nexus::PacketReader & reader)
+    {
+        id = reader.read<boost::uint32_t>();
+        owner = reader.read<boost::uint32_t>();
+        kind = reader.read<boost::uint16_t>();
+        flags = reader.read<boost::uint8_t>();
+        time = reader.read<boost::int64_t>();
+        x = reader.read<boost::int32_t>();
+        y = reader.read<boost::int32_t>();
+        z = reader.read<boost::int32_t>();
+        hp = reader.read<boost::uint16_t>();
+        mp = reader.read<boost::uint16_t>();
+        level = reader.read<boost::uint8_t>();
+        speed = reader.read<double>();
+    }
+
+    size_t checksum() const
+    {
+        return id ^ owner ^ kind ^ flags ^ static_cast<size_t>(time) ^ x ^ y ^ z ^ hp ^ mp ^ level ^ static_cast<size_t>(speed);
+    }
+};
+
+struct StringMessage {
+    std::string name;
+    std::string title;
+    std::string guild;
+    std::string status;
+    std::string description;
+
+    nexus::Buffer pack() const
+    {
+        size_t len = nexus::tupleSize(name, nexus::shortString(title), nexus::cString(guild), status, description);
+        return nexus::packCSD(pcStrings, len, name, nexus::shortString(title), nexus::cString(guild), status, description);
+    }
+
+    void unpack(nexus::PacketReader & reader)
+    {
+        reader.read(name);
+        title = reader.readShortString();
+        reader.readCString(guild);
+        reader.read(status);
+        reader.read(description);
+    }
+
+    size_t checksum() const
+    {
+        return name.size() ^ title[0] ^ guild.size() ^ status[status.size() - 1] ^ description.size();
+    }
+};
+
+struct NestedMessage {
+    std::vector<Item> items;
+    std::vector<std::string> tags;
+    std::vector<boost::uint32_t> ids;
+    std::vector<std::vector<boost::uint16_t> > groups;
+
+    nexus::Buffer pack() const
+    {
+        size_t len = nexus::tupleSize(items, tags, ids, groups);
+        return nexus::packCSD(pcNested, len, items, tags, ids, groups);
+    }
+
+    void unpack(nexus::PacketReader & reader)
+    {
+        items.clear();
+        tags.clear();
+        ids.clear();
+        reader.read(items);
+        reader.read(tags);
+        reader.read(ids);
+        groups.resize(reader.read<boost::uint16_t>());
+        for(std::vector<std::vector<boost::uint16_t> >::iterator i = groups.begin(), end = groups.end(); i != end; ++i)
+        {
+            i->clear();
+            reader.read(*i);
+        }
+    }
+
+    size_t checksum() const
+    {
+        return items.back().id ^ items.back().y ^ tags.back().size() ^ ids.back() ^ groups.back().back();
+    }
+};
+
+ScalarMessage makeScalar()
+{
+    ScalarMessage result;
+    result.id = 123456;
+    result.owner = 654321;
+    result.kind = 17;
+    result.flags = 3;
+    result.time = 1350000000000LL;
+    result.x = -1200;
+    result.y = 3400;
+    result.z = 15;
+    result.hp = 950;
+    result.mp = 120;
+    result.level = 42;
+    result.speed = 1.25;
+    return result;
+}
+
+StringMessage makeStrings()
+{
+    StringMessage result;
+    result.name = "player_name_0123";
+    result.title = "Keeper of the Northern Gate";
+    result.guild = "The Very Long Guild Name";
+    result.status = "away from keyboard, back in five minutes";
+    result.description.assign(200, 'd');
+    return result;
+}
+
+NestedMessage makeNested()
+{
+    NestedMessage result;
+    for(size_t i = 0; i != 32; ++i)
+    {
+        Item item = { static_cast<boost::uint32_t>(i * 1000), static_cast<boost::uint16_t>(i % 7),
+                      static_cast<boost::int32_t>(i * 3), -static_cast<boost::int32_t>(i * 5) };
+        result.items.push_back(item);
+        result.ids.push_back(static_cast<boost::uint32_t>(i * 17));
+    }
+    for(size_t i = 0; i != 8; ++i)
+        result.tags.push_back("tag_" + boost::lexical_cast<std::string>(i));
+    result.groups.resize(8);
+    for(size_t i = 0; i != result.groups.size(); ++i)
+        result.groups[i].assign(i + 1, static_cast<boost::uint16_t>(i));
+    return result;
+}
+
+struct Result {
+    const char * message;
+    const char * operation;
+    size_t iterations;
+    size_t packetSize;
+    double nanoseconds;
+    double heapBytes;
+    double heapBlocks;
+    double poolBytes;
+    size_t checksum; // of every packed buffer or unpacked message, so optimizer cannot drop the loop
+};
+
+class Measure {
+public:
+    Measure()
+        : heapBytes_(heapBytes), heapBlocks_(heapBlocks) {}
+
+    void finish(Result & result)
+    {
+        mstd::performance_mark stop;
+        double n = static_cast<double>(result.iterations);
+        result.nanoseconds = (stop - start_).nanoseconds() / n;
+        result.heapBytes = (heapBytes - heapBytes_) / n;
+        result.heapBlocks = (heapBlocks - heapBlocks_) / n;
+    }
+private:
+    size_t heapBytes_;
+    size_t heapBlocks_;
+    mstd::performance_mark start_;
+};
+
+template<class Message>
+Result benchPack(const char * name, const Message & message, size_t iterations)
+{
+    Result result = { name, "pack", iterations, message.pack().size(), 0, 0, 0, 0, 0 };
+    size_t poolBytes = 0;
+    Measure measure;
+    for(size_t i = 0; i != iterations; ++i)
+    {
+        nexus::Buffer buffer = message.pack();
+        poolBytes += buffer.capacity() + sizeof(size_t);
+        result.checksum += static_cast<unsigned char>(buffer.data()[buffer.size() - 1]);
+    }
+    measure.finish(result);
+    result.poolBytes = static_cast<double>(poolBytes) / iterations;
+    return result;
+}
+
+template<class Message>
+Result benchUnpack(const char * name, const Message & message, size_t iterations)
+{
+    nexus::Buffer buffer = message.pack();
+    Result result = { name, "unpack", iterations, buffer.size(), 0, 0, 0, 0, 0 };
+    Message out;
+    Measure measure;
+    for(size_t i = 0; i != iterations; ++i)
+    {
+        // volatile data pointer makes every iteration read the packet again
+        const char * volatile data = buffer.data();
+        nexus::PacketReader reader(data, buffer.size());
+        reader.skip(3);
+        out.unpack(reader);
+        BOOST_ASSERT(!reader.left());
+        result.checksum += out.checksum() + reader.left();
+    }
+    measure.finish(result);
+    return result;
+}
+
+void output(std::ostream & out, const std::vector<Result> & results)
+{
+    out << "{\"benchmark\":\"nexus.packet\",\"clock\":\"thread_cputime\",\"results\":[";
+    for(std::vector<Result>::const_iterator i = results.begin(), end = results.end(); i != end; ++i)
+    {
+        if(i != results.begin())
+            out << ',';
+        out << "{\"message\":\"" << i->message << "\",\"operation\":\"" << i->operation << "\""
+            << ",\"iterations\":" << i->iterations
+            << ",\"packet_bytes\":" << i->packetSize
+            << ",\"ns_per_message\":" << i->nanoseconds
+            << ",\"heap_bytes_per_message\":" << i->heapBytes
+            << ",\"heap_allocations_per_message\":" << i->heapBlocks
+            << ",\"pool_bytes_per_message\":" << i->poolBytes
+            << ",\"checksum\":" << i->checksum
+            << '}';
+    }
+    out << "]}" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t iterations = argc > 1 ? boost::lexical_cast<size_t>(argv[1]) : 1000000;
+
+    ScalarMessage scalar = makeScalar();
+    StringMessage strings = makeStrings();
+    NestedMessage nested = makeNested();
+
+    // warm up buffer pools before measuring
+    benchPack("warmup", nested, 1000);
+
+    std::vector<Result> results;
+    results.push_back(benchPack("scalar", scalar, iterations));
+    results.push_back(benchUnpack("scalar", scalar, iterations));
+    results.push_back(benchPack("strings", strings, iterations));
+    results.push_back(benchUnpack("strings", strings, iterations));
+    results.push_back(benchPack("nested", nested, iterations / 4));
+    results.push_back(benchUnpack("nested", nested, iterations / 4));
+
+    output(std::cout, results);
+
+    return 0;
+}
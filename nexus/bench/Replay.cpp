@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+
+#include <nexus/Capture.h>
+#include <nexus/Clock.h>
+
+namespace {
+
+typedef boost::shared_ptr<std::vector<char> > Data;
+
+struct Frame {
+    size_t connection; // index in connections
+    nexus::Microseconds time;
+    Data data;
+};
+
+// Called from io thread only, writes are queued, so slow connection does not delay others.
+class Client {
+public:
+    explicit Client(boost::asio::io_service & ioService)
+        : socket_(ioService), received_(0) {}
+
+    void connect(const boost::asio::ip::tcp::endpoint & endpoint)
+    {
+        socket_.connect(endpoint);
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+        startRead();
+    }
+
+    void send(const Data & data)
+    {
+        queue_.push_back(data);
+        if(queue_.size() == 1)
+            startWrite();
+    }
+
+    void close()
+    {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        socket_.close(ec);
+    }
+
+    size_t received() const
+    {
+        return received_;
+    }
+private:
+    void startWrite()
+    {
+        boost::asio::async_write(socket_, boost::asio::buffer(*queue_.front()),
+                                 boost::bind(&Client::handleWrite, this, boost::asio::placeholders::error));
+    }
+
+    void handleWrite(const boost::system::error_code & ec)
+    {
+        if(ec)
+        {
+            if(ec != boost::asio::error::operation_aborted)
+                std::cerr << "write failed: " << ec.message() << std::endl;
+            queue_.clear();
+            return;
+        }
+        queue_.pop_front();
+        if(!queue_.empty())
+            startWrite();
+    }
+
+    void startRead()
+    {
+        socket_.async_read_some(boost::asio::buffer(buffer_),
+                                boost::bind(&Client::handleRead, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    }
+
+    void handleRead(const boost::system::error_code & ec, size_t len)
+    {
+        received_ += len;
+        if(!ec)
+            startRead();
+    }
+
+    boost::asio::ip::tcp::socket socket_;
+    boost::array<char, 0x10000> buffer_;
+    mstd::atomic<size_t> received_;
+    std::deque<Data> queue_;
+};
+
+// Loads incoming frames and maps captured connection ids to dense indexes.
+// Connections that lost frames while capturing are skipped, their streams are incomplete.
+size_t load(const std::string & path, std::vector<Frame> & frames)
+{
+    std::vector<std::pair<boost::uint32_t, Frame> > incoming;
+    std::set<boost::uint32_t> truncated;
+    nexus::TrafficReader reader(path);
+    nexus::CapturedFrame captured;
+    while(reader.next(captured))
+    {
+        if(captured.direction == nexus::cdDropped)
+            truncated.insert(captured.connection);
+        if(captured.direction != nexus::cdIncoming || captured.data.empty())
+            continue;
+        Frame frame = { 0, captured.time, Data(new std::vector<char>()) };
+        frame.data->swap(captured.data);
+        incoming.push_back(std::make_pair(captured.connection, frame));
+    }
+    if(!truncated.empty())
+        std::cerr << "skipping " << truncated.size() << " truncated connections" << std::endl;
+
+    std::map<boost::uint32_t, size_t> ids;
+    for(std::vector<std::pair<boost::uint32_t, Frame> >::iterator i = incoming.begin(), end = incoming.end(); i != end; ++i)
+    {
+        if(truncated.count(i->first))
+            continue;
+        i->second.connection = ids.insert(std::make_pair(i->first, ids.size())).first->second;
+        frames.push_back(i->second);
+    }
+    return ids.size();
+}
+
+void runService(boost::asio::io_service * ioService)
+{
+    ioService->run();
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    if(argc < 4)
+    {
+        std::cerr << "usage: nexusreplay <capture> <host> <port> [speed=1, 0 for no delays] [copies=1]" << std::endl;
+        return 1;
+    }
+
+    std::string path = argv[1];
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(argv[2]), boost::lexical_cast<unsigned short>(argv[3]));
+    double speed = argc > 4 ? boost::lexical_cast<double>(argv[4]) : 1.0;
+    size_t copies = argc > 5 ? boost::lexical_cast<size_t>(argv[5]) : 1;
+
+    std::vector<Frame> frames;
+    size_t connections = load(path, frames);
+    if(frames.empty())
+    {
+        std::cerr << "no incoming frames in " << path << std::endl;
+        return 1;
+    }
+
+    boost::asio::io_service ioService;
+    boost::asio::io_service::work work(ioService);
+    boost::ptr_vector<Client> clients;
+    for(size_t i = 0; i != connections * copies; ++i)
+    {
+        clients.push_back(new Client(ioService));
+        clients.back().connect(endpoint);
+    }
+    boost::thread thread(boost::bind(&runService, &ioService));
+
+    size_t bytes = 0;
+    nexus::Microseconds maxLag = 0;
+    nexus::Microseconds first = frames.front().time;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(std::vector<Frame>::const_iterator i = frames.begin(), end = frames.end(); i != end; ++i)
+    {
+        if(speed > 0)
+        {
+            nexus::Microseconds due = start + static_cast<nexus::Microseconds>((i->time - first) / speed);
+            nexus::Microseconds now = nexus::Clock::microseconds();
+            if(due > now)
+                boost::this_thread::sleep(boost::posix_time::microseconds(due - now));
+            else
+                maxLag = std::max(maxLag, now - due);
+        }
+        for(size_t copy = 0; copy != copies; ++copy)
+            ioService.post(boost::bind(&Client::send, &clients[copy * connections + i->connection], i->data));
+        bytes += i->data->size() * copies;
+    }
+
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    // let the last responses arrive
+    boost::this_thread::sleep(boost::posix_time::seconds(1));
+
+    ioService.stop();
+    thread.join();
+
+    size_t received = 0;
+    for(boost::ptr_vector<Client>::iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+    {
+        received += i->received();
+        i->close();
+    }
+
+    std::cout << "{\"benchmark\":\"nexus.replay\",\"connections\":" << clients.size()
+              << ",\"frames\":" << frames.size() * copies
+              << ",\"bytes_sent\":" << bytes
+              << ",\"bytes_received\":" << received
+              << ",\"speed\":" << speed
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"max_lag_us\":" << maxLag
+              << '}' << std::endl;
+
+    return 0;
+}
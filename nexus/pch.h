@@ -2,11 +2,20 @@
 #pragma once
 #endif
 
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <algorithm>
 #include <deque>
 #include <exception>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -19,10 +28,13 @@
 #include <boost/noncopyable.hpp>
 
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
 
 #include <boost/mpl/bool.hpp>
 #include <boost/mpl/find_if.hpp>
+#include <boost/mpl/for_each.hpp>
 #include <boost/mpl/vector.hpp>
 
 #include <boost/preprocessor/expand.hpp>
@@ -44,6 +56,7 @@
 
 #include <boost/system/error_code.hpp>
 
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/tss.hpp>
 
@@ -76,6 +89,18 @@
 #include <mcrypt/MD5.h>
 #include <mcrypt/Utils.h>
 
+#if defined(__linux__)
+
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <linux/net_tstamp.h>
+
+#endif
+
 #if BOOST_WINDOWS
 
 #include <boost/bind/protect.hpp>